@@ -0,0 +1,281 @@
+#include "engine.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define bench_mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define bench_mkdir(path) mkdir(path, 0755)
+#endif
+
+// Renders a fixed orbit around one model headless, writes per-stage timings
+// and triangles/sec to JSON and compares every GOLDEN_EVERY-th frame against
+// the stored golden images. Run from the repo root, the paths are relative
+
+#define BENCH_SKIPPED 77 // CTest SKIP_RETURN_CODE, golden images missing and --allow-missing-golden
+#define BENCH_WARMUP 5   // frames rendered before timing starts, not compared
+#define GOLDEN_EVERY 30
+#define GOLDEN_CHANNEL_TOLERANCE 8 // channel difference a pixel may have and still match
+
+// Model placed at the origin, the camera circles target once over the run
+typedef struct {
+    const char* name;
+    const char* mesh;
+    const char* texture;
+    float scale;
+    f3 target;
+    float radius;
+    float height; // camera height above target
+} BenchScene;
+
+static const BenchScene s_scenes[] = {
+  { "bunny",  "res/bunny.obj",        NULL,                    10.0f, { 0.0f, 1.1f, 0.0f }, 2.5f, 0.5f },
+  { "slime",  "res/slime.obj",        "res/slime_texture.png",  1.0f, { 0.0f, 0.0f, 0.0f }, 2.0f, 0.6f },
+  { "rayman", "res/rayman_2_mdl.obj", "res/Rayman.png",         0.1f, { 0.0f, 0.7f, 0.0f }, 2.0f, 0.3f },
+};
+
+// Same order as EngineStage
+static const char* s_stageNames[STAGE_COUNT] = {
+  "clear", "vertex", "setup", "binning", "fragment", "readback", "host"
+};
+
+typedef struct {
+    const BenchScene* scene;
+    int width;
+    int height;
+    int frames;
+    cl_device_type deviceType;
+    bool native;
+    bool updateGolden;
+    bool allowMissing; // a missing golden skips instead of failing
+    float tolerance; // percent of pixels allowed to differ
+    const char* goldenDir;
+    const char* outDir;
+    const char* jsonPath;
+} Options;
+
+static double bench_now_ms()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// mkdir -p, every missing parent of path is created too
+static void bench_make_dirs(const char* path)
+{
+  char partial[512];
+  snprintf(partial, sizeof(partial), "%s", path);
+  for (char* c = partial + 1; *c; c++)
+  {
+    if (*c != '/' && *c != '\\') continue;
+    char separator = *c;
+    *c = '\0';
+    bench_mkdir(partial);
+    *c = separator;
+  }
+  bench_mkdir(partial);
+}
+
+static int bench_compare_floats(const void* a, const void* b)
+{
+  float fa = *(const float*)a, fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+static Options parse_options(int argc, char** argv)
+{
+  Options opt = { NULL, 320, 240, 120, CL_DEVICE_TYPE_CPU, false, false, false, 0.5f, "tests/golden", "bench_output", NULL };
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+    {
+      const char* name = argv[++i];
+      for (size_t s = 0; s < sizeof(s_scenes) / sizeof(s_scenes[0]); s++)
+        if (strcmp(s_scenes[s].name, name) == 0) opt.scene = &s_scenes[s];
+      if (!opt.scene) printf("Unknown scene: %s\n", name);
+    }
+    else if (strcmp(argv[i], "--any-device") == 0) opt.deviceType = CL_DEVICE_TYPE_ALL;
+    else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) engine_select_devices(argv[++i]);
+    else if (strcmp(argv[i], "--native") == 0) opt.native = true;
+    else if (strcmp(argv[i], "--update-golden") == 0) opt.updateGolden = true;
+    else if (strcmp(argv[i], "--allow-missing-golden") == 0) opt.allowMissing = true;
+    else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) opt.tolerance = (float)atof(argv[++i]);
+    else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) opt.width = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) opt.height = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) opt.frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--golden-dir") == 0 && i + 1 < argc) opt.goldenDir = argv[++i];
+    else if (strcmp(argv[i], "--out-dir") == 0 && i + 1 < argc) opt.outDir = argv[++i];
+    else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) opt.jsonPath = argv[++i];
+    else printf("Unknown option: %s\n", argv[i]);
+  }
+
+  return opt;
+}
+
+static void bench_place_camera(const BenchScene* scene, int frame, int frames)
+{
+  float angle = 2.0f * PI * (float)frame / (float)frames;
+  f3 position = { scene->target.x + sinf(angle) * scene->radius,
+                  scene->target.y + scene->height,
+                  scene->target.z - cosf(angle) * scene->radius };
+  engine_set_camera(position, scene->target);
+}
+
+// Percent of pixels with a channel off by more than GOLDEN_CHANNEL_TOLERANCE,
+// -1 when the images cannot be compared
+static float bench_compare_images(const char* framePath, const char* goldenPath)
+{
+  Image frame = LoadImage(framePath);
+  Image golden = LoadImage(goldenPath);
+  float percent = -1.0f;
+
+  if (frame.data && golden.data && frame.width == golden.width && frame.height == golden.height)
+  {
+    ImageFormat(&frame, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    ImageFormat(&golden, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    const unsigned char* a = (const unsigned char*)frame.data;
+    const unsigned char* b = (const unsigned char*)golden.data;
+
+    size_t pixels = (size_t)frame.width * frame.height;
+    size_t differing = 0;
+    for (size_t p = 0; p < pixels; p++)
+      for (int c = 0; c < 4; c++)
+        if (abs((int)a[p * 4 + c] - (int)b[p * 4 + c]) > GOLDEN_CHANNEL_TOLERANCE) { differing++; break; }
+    percent = 100.0f * (float)differing / (float)pixels;
+  }
+
+  UnloadImage(frame);
+  UnloadImage(golden);
+  return percent;
+}
+
+static void bench_write_stage(FILE* f, const char* indent, const char* name, StageStats s, bool last)
+{
+  fprintf(f, "%s\"%s\": { \"min\": %.4f, \"avg\": %.4f, \"p99\": %.4f }%s\n",
+          indent, name, s.min, s.avg, s.p99, last ? "" : ",");
+}
+
+static bool bench_write_json(const Options* opt, const char* backend, const float* frameMs, double triangles,
+                             int compared, int failed, int missing)
+{
+  FILE* f = fopen(opt->jsonPath, "w");
+  if (!f) { printf("Cannot open %s\n", opt->jsonPath); return false; }
+
+  float* sorted = (float*)malloc(opt->frames * sizeof(float));
+  memcpy(sorted, frameMs, opt->frames * sizeof(float));
+  qsort(sorted, opt->frames, sizeof(float), bench_compare_floats);
+  double totalMs = 0.0;
+  for (int i = 0; i < opt->frames; i++) totalMs += sorted[i];
+  int p99 = (int)ceilf(0.99f * opt->frames) - 1;
+  StageStats frame = { sorted[0], (float)(totalMs / opt->frames), sorted[p99 < 0 ? 0 : p99], frameMs[opt->frames - 1] };
+  free(sorted);
+
+  EngineStats stats = engine_get_stats();
+  fprintf(f, "{\n");
+  fprintf(f, "  \"scene\": \"%s\",\n", opt->scene->name);
+  fprintf(f, "  \"backend\": \"%s\",\n", backend);
+  fprintf(f, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n", opt->width, opt->height, opt->frames);
+  fprintf(f, "  \"triangles_per_frame\": %.1f,\n", triangles / opt->frames);
+  fprintf(f, "  \"triangles_per_sec\": %.1f,\n", totalMs > 0.0 ? triangles / (totalMs / 1000.0) : 0.0);
+  bench_write_stage(f, "  ", "frame_ms", frame, false);
+  fprintf(f, "  \"stages_ms\": {\n");
+  for (int stage = 0; stage < STAGE_COUNT; stage++)
+    bench_write_stage(f, "    ", s_stageNames[stage], stats.stages[stage], stage == STAGE_COUNT - 1);
+  fprintf(f, "  },\n");
+  fprintf(f, "  \"golden\": { \"compared\": %d, \"failed\": %d, \"missing\": %d }\n", compared, failed, missing);
+  fprintf(f, "}\n");
+
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  Options opt = parse_options(argc, argv);
+  if (!opt.scene || opt.frames <= 0)
+  {
+    printf("Usage: gabcl_bench --scene bunny|slime|rayman [--frames n] [--json path] [--update-golden]\n");
+    return 2;
+  }
+
+  engine_set_native_backend(opt.native);
+  engine_init_headless("src/shapes.cl", opt.width, opt.height, opt.deviceType);
+  engine_background_color((Color){0,0,0,255});
+  engine_init_camera(opt.width, opt.height, 90.0f, 0.01f, 1000.0f);
+
+  engine_load_model(opt.scene->mesh, opt.scene->texture,
+                    MatTransform((f3){0.0f, 0.0f, 0.0f}, (f3){0.0f, 0.0f, 0.0f},
+                                 (f3){opt.scene->scale, opt.scene->scale, opt.scene->scale}));
+  engine_upload_models_data();
+
+  bench_make_dirs(opt.outDir);
+  if (opt.updateGolden) bench_make_dirs(opt.goldenDir);
+
+  float* frameMs = (float*)malloc(opt.frames * sizeof(float));
+  double triangles = 0.0;
+  int compared = 0, failed = 0, missing = 0;
+  // What init ended up on, without a matching device it falls back to native
+  bool native = engine_is_native();
+  if (native && !opt.native) printf("No OpenCL device, benchmarking the native rasterizer\n");
+  const char* suffix = native ? "_native" : "";
+
+  char framePath[512], goldenPath[512];
+  for (int frame = -BENCH_WARMUP; frame < opt.frames; frame++)
+  {
+    bench_place_camera(opt.scene, frame < 0 ? 0 : frame, opt.frames);
+
+    double start = bench_now_ms();
+    engine_clear_background();
+    engine_send_camera_matrix();
+    engine_run_rasterizer();
+    engine_read_frame();
+    if (frame < 0) continue;
+
+    frameMs[frame] = (float)(bench_now_ms() - start);
+    triangles += (double)engine_get_stats().triangles;
+
+    if (frame % GOLDEN_EVERY != 0) continue;
+
+    // The native rasterizer differs from the kernels in coverage, it gets its own images
+    snprintf(goldenPath, sizeof(goldenPath), "%s/%s%s_%04d.png", opt.goldenDir, opt.scene->name, suffix, frame);
+    if (opt.updateGolden)
+    {
+      if (!engine_save_frame(goldenPath)) printf("Failed to write %s\n", goldenPath);
+      continue;
+    }
+
+    FILE* golden = fopen(goldenPath, "rb");
+    if (!golden) { printf("No golden image %s, run with --update-golden\n", goldenPath); missing++; continue; }
+    fclose(golden);
+
+    snprintf(framePath, sizeof(framePath), "%s/%s%s_%04d.png", opt.outDir, opt.scene->name, suffix, frame);
+    if (!engine_save_frame(framePath)) { printf("Failed to write %s\n", framePath); failed++; continue; }
+
+    float percent = bench_compare_images(framePath, goldenPath);
+    compared++;
+    if (percent < 0.0f || percent > opt.tolerance)
+    {
+      failed++;
+      if (percent < 0.0f) printf("%s: size differs from %s\n", framePath, goldenPath);
+      else printf("%s: %.2f%% of pixels differ from %s (tolerance %.2f%%)\n", framePath, percent, goldenPath, opt.tolerance);
+    }
+  }
+
+  engine_print_stats();
+  if (opt.jsonPath) bench_write_json(&opt, native ? "native" : "opencl", frameMs, triangles, compared, failed, missing);
+  printf("%s: %d frames, %d compared, %d failed, %d missing\n", opt.scene->name, opt.frames, compared, failed, missing);
+
+  free(frameMs);
+  engine_free_all_models();
+  engine_close();
+
+  if (failed > 0 || (missing > 0 && !opt.allowMissing)) return 1;
+  return missing > 0 ? BENCH_SKIPPED : 0;
+}
@@ -0,0 +1,607 @@
+#include "cpu_raster.h"
+#include "stb_ds.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <time.h>
+
+// Spans of 8 pixels are tested with AVX2 when the file is built for it
+// (GABCL_AVX2 in CMake), as two SSE2 halves on other x86-64 builds, else scalar
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CPU_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CPU_SSE2 1
+#endif
+
+#define CPU_TILE 32 // tile edge in pixels, a multiple of CPU_SPAN
+#define CPU_SPAN 8
+#define CPU_MAX_THREADS 32
+#define CPU_VERTEX_CHUNK 4096
+#define CPU_TRIANGLE_CHUNK 1024
+#define TEX_BLOCK 8 // texture block edge, must match engine.c
+
+typedef struct { float x, y, z, w; } CpuVec4;
+
+// Triangle after setup. Each barycentric is edgeC + edgeA * x + edgeB * y with
+// x/y relative to the bounding box origin, so a span is one multiply-add away.
+// Same 0.5 scaled barycentrics as setup_kernel/raster_triangle
+typedef struct {
+    float edgeA[3], edgeB[3], edgeC[3];
+    float z0, z1, z2;
+    int minX, maxX, minY, maxY;
+    int instance;
+    int meshTriangle;
+} CpuTriangle;
+
+// A slice of one instance's vertices or triangles, output indexes the frame streams
+typedef struct {
+    int instance;
+    int first;
+    int count;
+    int output;
+} CpuChunk;
+
+// Per worker, per tile list of setup triangle indices
+typedef struct {
+    int* items;
+    int count;
+    int capacity;
+} CpuBin;
+
+typedef void (*CpuTask)(int item, int worker, void* ctx);
+
+// Work-stealing queue over a range of items, head in the low half and tail in
+// the high half so the owner (front) and thieves (back) race on one CAS
+typedef struct {
+    _Atomic uint64_t range;
+    char pad[56]; // own cache line
+} CpuQueue;
+
+static thrd_t s_threads[CPU_MAX_THREADS];
+static CpuQueue s_queues[CPU_MAX_THREADS];
+static int s_numWorkers = 0; // the rendering thread is worker 0
+static mtx_t s_poolMutex;
+static cnd_t s_poolWake;
+static cnd_t s_poolDone;
+static int s_generation = 0;
+static int s_busy = 0;
+static bool s_quit = false;
+static CpuTask s_task = NULL;
+static void* s_taskCtx = NULL;
+
+static int s_width = 0;
+static int s_height = 0;
+static int s_tilesX = 0;
+static int s_tilesY = 0;
+static int s_binCount = 0; // tiles at the init size, frames may render smaller
+
+static CpuVec4* s_projected = NULL;
+static CpuTriangle* s_setup = NULL;
+static f4x4* s_instanceClip = NULL;  // projection * view * transform, batch multiplied
+static int* s_vertexBase = NULL;     // first projected vertex of each instance
+static CpuChunk* s_vertexChunks = NULL;
+static CpuChunk* s_triangleChunks = NULL;
+static CpuBin* s_bins[CPU_MAX_THREADS];
+static float s_tileDepth[CPU_MAX_THREADS][CPU_TILE * CPU_TILE];
+static int s_tileIds[CPU_MAX_THREADS][CPU_TILE * CPU_TILE];
+static Color* s_target = NULL;
+
+static double cpu_now_ms()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec * 1e-6;
+}
+
+static uint64_t cpu_pack_range(uint32_t head, uint32_t tail)
+{
+  return (uint64_t)head | ((uint64_t)tail << 32);
+}
+
+static int cpu_pop(CpuQueue* queue)
+{
+  uint64_t range = atomic_load(&queue->range);
+  for (;;)
+  {
+    uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+    if (head >= tail) return -1;
+    if (atomic_compare_exchange_weak(&queue->range, &range, cpu_pack_range(head + 1, tail))) return (int)head;
+  }
+}
+
+static int cpu_steal(CpuQueue* queue)
+{
+  uint64_t range = atomic_load(&queue->range);
+  for (;;)
+  {
+    uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+    if (head >= tail) return -1;
+    if (atomic_compare_exchange_weak(&queue->range, &range, cpu_pack_range(head, tail - 1))) return (int)tail - 1;
+  }
+}
+
+// Drains the worker's own queue front to back, then steals from the back of the others
+static void cpu_run_items(int worker)
+{
+  int item;
+  while ((item = cpu_pop(&s_queues[worker])) >= 0)
+    s_task(item, worker, s_taskCtx);
+
+  for (int i = 1; i < s_numWorkers; i++)
+  {
+    CpuQueue* victim = &s_queues[(worker + i) % s_numWorkers];
+    while ((item = cpu_steal(victim)) >= 0)
+      s_task(item, worker, s_taskCtx);
+  }
+}
+
+static int cpu_worker(void* arg)
+{
+  int worker = (int)(intptr_t)arg;
+  int seen = 0;
+
+  for (;;)
+  {
+    mtx_lock(&s_poolMutex);
+    while (s_generation == seen && !s_quit)
+      cnd_wait(&s_poolWake, &s_poolMutex);
+    if (s_quit) { mtx_unlock(&s_poolMutex); return 0; }
+    seen = s_generation;
+    mtx_unlock(&s_poolMutex);
+
+    cpu_run_items(worker);
+
+    mtx_lock(&s_poolMutex);
+    if (--s_busy == 0) cnd_signal(&s_poolDone);
+    mtx_unlock(&s_poolMutex);
+  }
+}
+
+// Runs task over [0, count) on every worker, returns once all items are done
+static void cpu_parallel_for(int count, CpuTask task, void* ctx)
+{
+  if (count <= 0) return;
+
+  s_task = task;
+  s_taskCtx = ctx;
+  for (int w = 0; w < s_numWorkers; w++)
+  {
+    uint32_t head = (uint32_t)((int64_t)count * w / s_numWorkers);
+    uint32_t tail = (uint32_t)((int64_t)count * (w + 1) / s_numWorkers);
+    atomic_store(&s_queues[w].range, cpu_pack_range(head, tail));
+  }
+
+  mtx_lock(&s_poolMutex);
+  s_busy = s_numWorkers - 1;
+  s_generation++;
+  cnd_broadcast(&s_poolWake);
+  mtx_unlock(&s_poolMutex);
+
+  cpu_run_items(0);
+
+  mtx_lock(&s_poolMutex);
+  while (s_busy > 0)
+    cnd_wait(&s_poolDone, &s_poolMutex);
+  mtx_unlock(&s_poolMutex);
+}
+
+bool cpu_raster_init(int width, int height, int threads)
+{
+  s_width = width;
+  s_height = height;
+  s_tilesX = (width + CPU_TILE - 1) / CPU_TILE;
+  s_tilesY = (height + CPU_TILE - 1) / CPU_TILE;
+
+  s_numWorkers = threads < 1 ? 1 : threads > CPU_MAX_THREADS ? CPU_MAX_THREADS : threads;
+  s_binCount = s_tilesX * s_tilesY;
+  for (int w = 0; w < s_numWorkers; w++)
+    s_bins[w] = (CpuBin*)calloc((size_t)s_binCount, sizeof(CpuBin));
+
+  s_quit = false;
+  s_generation = 0;
+  if (mtx_init(&s_poolMutex, mtx_plain) != thrd_success ||
+      cnd_init(&s_poolWake) != thrd_success || cnd_init(&s_poolDone) != thrd_success)
+  {
+    printf("Cannot create the rasterizer thread pool\n");
+    return false;
+  }
+
+  for (int w = 1; w < s_numWorkers; w++)
+  {
+    if (thrd_create(&s_threads[w], cpu_worker, (void*)(intptr_t)w) != thrd_success)
+    {
+      s_numWorkers = w;
+      break;
+    }
+  }
+  printf("Native rasterizer running on %d threads\n", s_numWorkers);
+  return true;
+}
+
+void cpu_raster_shutdown()
+{
+  mtx_lock(&s_poolMutex);
+  s_quit = true;
+  cnd_broadcast(&s_poolWake);
+  mtx_unlock(&s_poolMutex);
+
+  for (int w = 1; w < s_numWorkers; w++)
+    thrd_join(s_threads[w], NULL);
+
+  for (int w = 0; w < s_numWorkers; w++)
+  {
+    for (int t = 0; t < s_binCount; t++)
+      free(s_bins[w][t].items);
+    free(s_bins[w]);
+    s_bins[w] = NULL;
+  }
+
+  mtx_destroy(&s_poolMutex);
+  cnd_destroy(&s_poolWake);
+  cnd_destroy(&s_poolDone);
+
+  arrfree(s_projected);
+  arrfree(s_setup);
+  arrfree(s_instanceClip);
+  arrfree(s_vertexBase);
+  arrfree(s_vertexChunks);
+  arrfree(s_triangleChunks);
+  s_numWorkers = 0;
+}
+
+static void cpu_bin_push(CpuBin* bin, int item)
+{
+  if (bin->count == bin->capacity)
+  {
+    bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+    bin->items = (int*)realloc(bin->items, bin->capacity * sizeof(int));
+  }
+  bin->items[bin->count++] = item;
+}
+
+// Same transform and viewport mapping as vertex_kernel
+static void cpu_vertex_task(int item, int worker, void* ctx)
+{
+  (void)worker;
+  const CpuScene* scene = (const CpuScene*)ctx;
+  const CpuChunk* chunk = &s_vertexChunks[item];
+  const CpuInstance* inst = &scene->instances[chunk->instance];
+  const f4x4* m = &s_instanceClip[chunk->instance];
+
+  for (int i = 0; i < chunk->count; i++)
+  {
+    const f3* p = &scene->vertices[inst->meshVertexOffset + chunk->first + i].position;
+    float cx = m->f[0][0] * p->x + m->f[0][1] * p->y + m->f[0][2] * p->z + m->f[0][3];
+    float cy = m->f[1][0] * p->x + m->f[1][1] * p->y + m->f[1][2] * p->z + m->f[1][3];
+    float cz = m->f[2][0] * p->x + m->f[2][1] * p->y + m->f[2][2] * p->z + m->f[2][3];
+    float cw = m->f[3][0] * p->x + m->f[3][1] * p->y + m->f[3][2] * p->z + m->f[3][3];
+
+    CpuVec4* out = &s_projected[chunk->output + i];
+    out->x = (cx / cw * 0.5f + 0.5f) * (float)s_width;
+    out->y = (cy / cw * 0.5f + 0.5f) * (float)s_height;
+    out->z = cz / cw * 0.5f + 0.5f;
+    out->w = cw;
+  }
+}
+
+// 0.5 * SignedTriangleArea(P, b, c) as coefficients of P relative to (ox, oy)
+static void cpu_edge(CpuVec4 b, CpuVec4 c, float invArea, float ox, float oy, float* ea, float* eb, float* ec)
+{
+  *ea = 0.5f * (b.y - c.y) * invArea;
+  *eb = 0.5f * (c.x - b.x) * invArea;
+  *ec = 0.5f * ((b.x - ox) * (c.y - oy) - (b.y - oy) * (c.x - ox)) * invArea;
+}
+
+// Culling and setup as in setup_kernel, survivors go to this worker's tile bins
+static void cpu_setup_task(int item, int worker, void* ctx)
+{
+  const CpuScene* scene = (const CpuScene*)ctx;
+  const CpuChunk* chunk = &s_triangleChunks[item];
+  const CpuInstance* inst = &scene->instances[chunk->instance];
+  const CpuVec4* projected = &s_projected[s_vertexBase[chunk->instance]];
+  CpuBin* bins = s_bins[worker];
+
+  for (int i = 0; i < chunk->count; i++)
+  {
+    int meshTriangle = inst->meshTriangleOffset + chunk->first + i;
+    const Triangle* tri = &scene->triangles[meshTriangle];
+    CpuVec4 p0 = projected[tri->indices[0]];
+    CpuVec4 p1 = projected[tri->indices[1]];
+    CpuVec4 p2 = projected[tri->indices[2]];
+
+    if (p0.w >= 0 || p1.w >= 0 || p2.w >= 0) continue;
+
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area <= 0.0f) continue;
+
+    float minX = fmaxf(floorf(fminf(p0.x, fminf(p1.x, p2.x))), 0.0f);
+    float maxX = fminf(ceilf(fmaxf(p0.x, fmaxf(p1.x, p2.x))), (float)(s_width - 1));
+    float minY = fmaxf(floorf(fminf(p0.y, fminf(p1.y, p2.y))), 0.0f);
+    float maxY = fminf(ceilf(fmaxf(p0.y, fmaxf(p1.y, p2.y))), (float)(s_height - 1));
+    if (minX > maxX || minY > maxY) continue;
+
+    int index = chunk->output + i;
+    CpuTriangle* t = &s_setup[index];
+    t->minX = (int)minX; t->maxX = (int)maxX;
+    t->minY = (int)minY; t->maxY = (int)maxY;
+    t->z0 = p0.z / p0.w;
+    t->z1 = p1.z / p1.w;
+    t->z2 = p2.z / p2.w;
+    t->instance = chunk->instance;
+    t->meshTriangle = meshTriangle;
+
+    float invArea = 1.0f / area;
+    cpu_edge(p1, p2, invArea, minX, minY, &t->edgeA[0], &t->edgeB[0], &t->edgeC[0]);
+    cpu_edge(p2, p0, invArea, minX, minY, &t->edgeA[1], &t->edgeB[1], &t->edgeC[1]);
+    cpu_edge(p0, p1, invArea, minX, minY, &t->edgeA[2], &t->edgeB[2], &t->edgeC[2]);
+
+    for (int ty = t->minY / CPU_TILE; ty <= t->maxY / CPU_TILE; ty++)
+      for (int tx = t->minX / CPU_TILE; tx <= t->maxX / CPU_TILE; tx++)
+        cpu_bin_push(&bins[ty * s_tilesX + tx], index);
+  }
+}
+
+// Coverage and depth test of CPU_SPAN pixels, x is the first pixel center
+// relative to the triangle's origin. Winners take the depth and triangle id
+static inline void cpu_span(const CpuTriangle* t, float x, float rowA, float rowB, float rowG,
+                            float* depth, int* ids, int id)
+{
+#if defined(CPU_AVX2)
+  __m256 px = _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+  __m256 a = _mm256_add_ps(_mm256_set1_ps(rowA), _mm256_mul_ps(_mm256_set1_ps(t->edgeA[0]), px));
+  __m256 b = _mm256_add_ps(_mm256_set1_ps(rowB), _mm256_mul_ps(_mm256_set1_ps(t->edgeA[1]), px));
+  __m256 g = _mm256_add_ps(_mm256_set1_ps(rowG), _mm256_mul_ps(_mm256_set1_ps(t->edgeA[2]), px));
+  __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(t->z0)),
+                                         _mm256_mul_ps(b, _mm256_set1_ps(t->z1))),
+                           _mm256_mul_ps(g, _mm256_set1_ps(t->z2)));
+
+  __m256 zero = _mm256_setzero_ps();
+  __m256 d = _mm256_loadu_ps(depth);
+  __m256 mask = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(a, zero, _CMP_GE_OQ), _mm256_cmp_ps(b, zero, _CMP_GE_OQ)),
+                              _mm256_and_ps(_mm256_cmp_ps(g, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, d, _CMP_LT_OQ)));
+  if (_mm256_movemask_ps(mask) == 0) return;
+
+  __m256 oldIds = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)ids));
+  __m256 newIds = _mm256_castsi256_ps(_mm256_set1_epi32(id));
+  _mm256_storeu_ps(depth, _mm256_blendv_ps(d, z, mask));
+  _mm256_storeu_si256((__m256i*)ids, _mm256_castps_si256(_mm256_blendv_ps(oldIds, newIds, mask)));
+#elif defined(CPU_SSE2)
+  for (int h = 0; h < CPU_SPAN; h += 4)
+  {
+    __m128 px = _mm_add_ps(_mm_set1_ps(x + h), _mm_setr_ps(0, 1, 2, 3));
+    __m128 a = _mm_add_ps(_mm_set1_ps(rowA), _mm_mul_ps(_mm_set1_ps(t->edgeA[0]), px));
+    __m128 b = _mm_add_ps(_mm_set1_ps(rowB), _mm_mul_ps(_mm_set1_ps(t->edgeA[1]), px));
+    __m128 g = _mm_add_ps(_mm_set1_ps(rowG), _mm_mul_ps(_mm_set1_ps(t->edgeA[2]), px));
+    __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_set1_ps(t->z0)), _mm_mul_ps(b, _mm_set1_ps(t->z1))),
+                          _mm_mul_ps(g, _mm_set1_ps(t->z2)));
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 d = _mm_loadu_ps(depth + h);
+    __m128 mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)),
+                             _mm_and_ps(_mm_cmpge_ps(g, zero), _mm_cmplt_ps(z, d)));
+    if (_mm_movemask_ps(mask) == 0) continue;
+
+    __m128i maskBits = _mm_castps_si128(mask);
+    __m128i oldIds = _mm_loadu_si128((const __m128i*)(ids + h));
+    _mm_storeu_ps(depth + h, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, d)));
+    _mm_storeu_si128((__m128i*)(ids + h), _mm_or_si128(_mm_and_si128(maskBits, _mm_set1_epi32(id)),
+                                                       _mm_andnot_si128(maskBits, oldIds)));
+  }
+#else
+  for (int i = 0; i < CPU_SPAN; i++)
+  {
+    float a = rowA + t->edgeA[0] * (x + i);
+    float b = rowB + t->edgeA[1] * (x + i);
+    float g = rowG + t->edgeA[2] * (x + i);
+    float z = a * t->z0 + b * t->z1 + g * t->z2;
+    if (a >= 0 && b >= 0 && g >= 0 && z < depth[i]) { depth[i] = z; ids[i] = id; }
+  }
+#endif
+}
+
+static void cpu_raster_triangle(const CpuTriangle* t, int id, int tileX, int tileY, float* depth, int* ids)
+{
+  int x0 = t->minX > tileX ? t->minX : tileX;
+  int x1 = t->maxX < tileX + CPU_TILE - 1 ? t->maxX : tileX + CPU_TILE - 1;
+  int y0 = t->minY > tileY ? t->minY : tileY;
+  int y1 = t->maxY < tileY + CPU_TILE - 1 ? t->maxY : tileY + CPU_TILE - 1;
+  if (x0 > x1 || y0 > y1) return;
+
+  // Spans are aligned to the tile so they never leave its row
+  int spanStart = tileX + ((x0 - tileX) & ~(CPU_SPAN - 1));
+  for (int y = y0; y <= y1; y++)
+  {
+    float py = y + 0.5f - t->minY;
+    float rowA = t->edgeC[0] + t->edgeB[0] * py;
+    float rowB = t->edgeC[1] + t->edgeB[1] * py;
+    float rowG = t->edgeC[2] + t->edgeB[2] * py;
+
+    int row = (y - tileY) * CPU_TILE;
+    for (int x = spanStart; x <= x1; x += CPU_SPAN)
+      cpu_span(t, x + 0.5f - t->minX, rowA, rowB, rowG, depth + row + x - tileX, ids + row + x - tileX, id);
+  }
+}
+
+static int cpu_morton_spread(int v)
+{
+  v = (v | (v << 2)) & 0x33;
+  return (v | (v << 1)) & 0x55;
+}
+
+static f3 cpu_fetch_texel(const Color* texture, int width, int height, int x, int y)
+{
+  x = x < 0 ? 0 : x >= width ? width - 1 : x;
+  y = y < 0 ? 0 : y >= height ? height - 1 : y;
+  int blocksX = (width + TEX_BLOCK - 1) / TEX_BLOCK;
+  int block = (y / TEX_BLOCK) * blocksX + (x / TEX_BLOCK);
+  Color c = texture[block * TEX_BLOCK * TEX_BLOCK + (cpu_morton_spread(x % TEX_BLOCK) | (cpu_morton_spread(y % TEX_BLOCK) << 1))];
+  return (f3){ c.r, c.g, c.b };
+}
+
+// Bilinear on the base level, the kernels' mip selection is left to the GPU path
+static f3 cpu_sample_texture(const Color* texture, int width, int height, float u, float v)
+{
+  u = fminf(fmaxf(u, 0.001f), 0.999f);
+  v = fminf(fmaxf(v, 0.001f), 0.999f);
+
+  float x = u * width - 0.5f, y = (1.0f - v) * height - 0.5f;
+  float fx = floorf(x), fy = floorf(y);
+  int x0 = (int)fx, y0 = (int)fy;
+  float tx = x - fx, ty = y - fy;
+
+  f3 c00 = cpu_fetch_texel(texture, width, height, x0, y0);
+  f3 c10 = cpu_fetch_texel(texture, width, height, x0 + 1, y0);
+  f3 c01 = cpu_fetch_texel(texture, width, height, x0, y0 + 1);
+  f3 c11 = cpu_fetch_texel(texture, width, height, x0 + 1, y0 + 1);
+
+  float w00 = (1 - tx) * (1 - ty), w10 = tx * (1 - ty), w01 = (1 - tx) * ty, w11 = tx * ty;
+  return (f3){ (c00.x * w00 + c10.x * w10 + c01.x * w01 + c11.x * w11) / 255.0f,
+               (c00.y * w00 + c10.y * w10 + c01.y * w01 + c11.y * w11) / 255.0f,
+               (c00.z * w00 + c10.z * w10 + c01.z * w01 + c11.z * w11) / 255.0f };
+}
+
+// shade_fragment for the fixed directional light, clustered lights are GPU only
+static Color cpu_shade(const CpuScene* scene, const CpuTriangle* t, int x, int y)
+{
+  float px = x + 0.5f - t->minX, py = y + 0.5f - t->minY;
+  float a = t->edgeC[0] + t->edgeA[0] * px + t->edgeB[0] * py;
+  float b = t->edgeC[1] + t->edgeA[1] * px + t->edgeB[1] * py;
+  float g = t->edgeC[2] + t->edgeA[2] * px + t->edgeB[2] * py;
+  float depth = a * t->z0 + b * t->z1 + g * t->z2;
+  float wa = a * t->z0 / depth, wb = b * t->z1 / depth, wg = g * t->z2 / depth;
+
+  const CpuInstance* inst = &scene->instances[t->instance];
+  const Triangle* tri = &scene->triangles[t->meshTriangle];
+  const Vertex* v0 = &scene->vertices[inst->meshVertexOffset + tri->indices[0]];
+  const Vertex* v1 = &scene->vertices[inst->meshVertexOffset + tri->indices[1]];
+  const Vertex* v2 = &scene->vertices[inst->meshVertexOffset + tri->indices[2]];
+
+  f3 color = { 0.8f, 0.8f, 0.8f };
+  if (inst->texWidth > 0 && inst->texHeight > 0)
+  {
+    float u = v0->uv.x * wa + v1->uv.x * wb + v2->uv.x * wg;
+    float v = v0->uv.y * wa + v1->uv.y * wb + v2->uv.y * wg;
+    color = cpu_sample_texture(scene->texels + inst->pixelOffset, inst->texWidth, inst->texHeight, u, v);
+  }
+
+  if (scene->lighting)
+  {
+    f3 n = { v0->normal.x * wa + v1->normal.x * wb + v2->normal.x * wg,
+             v0->normal.y * wa + v1->normal.y * wb + v2->normal.y * wg,
+             v0->normal.z * wa + v1->normal.z * wb + v2->normal.z * wg };
+    float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+    float intensity = 0.1f;
+    if (length > 0.0f)
+    {
+      const float light = 0.70710678f; // normalize(LIGHT_DIR) of shapes.cl, (5, 5, 0)
+      intensity = fmaxf(0.1f, (n.x * light + n.y * light) / length);
+    }
+    color.x *= intensity; color.y *= intensity; color.z *= intensity;
+  }
+
+  return (Color){ (unsigned char)(color.x * 255), (unsigned char)(color.y * 255), (unsigned char)(color.z * 255), 255 };
+}
+
+// Resolves visibility for the whole tile first, then shades every pixel once
+static void cpu_tile_task(int tile, int worker, void* ctx)
+{
+  const CpuScene* scene = (const CpuScene*)ctx;
+  int tileX = (tile % s_tilesX) * CPU_TILE;
+  int tileY = (tile / s_tilesX) * CPU_TILE;
+  float* depth = s_tileDepth[worker];
+  int* ids = s_tileIds[worker];
+
+  for (int i = 0; i < CPU_TILE * CPU_TILE; i++)
+  {
+    depth[i] = FLT_MAX;
+    ids[i] = -1;
+  }
+
+  for (int w = 0; w < s_numWorkers; w++)
+  {
+    const CpuBin* bin = &s_bins[w][tile];
+    for (int i = 0; i < bin->count; i++)
+      cpu_raster_triangle(&s_setup[bin->items[i]], bin->items[i], tileX, tileY, depth, ids);
+  }
+
+  int width = s_width - tileX < CPU_TILE ? s_width - tileX : CPU_TILE;
+  int height = s_height - tileY < CPU_TILE ? s_height - tileY : CPU_TILE;
+  for (int y = 0; y < height; y++)
+  {
+    Color* row = s_target + (size_t)(tileY + y) * s_width + tileX;
+    for (int x = 0; x < width; x++)
+    {
+      int id = ids[y * CPU_TILE + x];
+      row[x] = id < 0 ? scene->background : cpu_shade(scene, &s_setup[id], tileX + x, tileY + y);
+    }
+  }
+}
+
+static void cpu_add_chunks(CpuChunk** chunks, int instance, int count, int chunkSize, int output)
+{
+  for (int first = 0; first < count; first += chunkSize)
+  {
+    CpuChunk chunk = { instance, first, count - first < chunkSize ? count - first : chunkSize, output + first };
+    arrpush(*chunks, chunk);
+  }
+}
+
+void cpu_raster_render(const CpuScene* scene, Color* target, float stageMs[STAGE_COUNT])
+{
+  double start = cpu_now_ms();
+  s_target = target;
+  s_width = scene->width;
+  s_height = scene->height;
+  s_tilesX = (s_width + CPU_TILE - 1) / CPU_TILE;
+  s_tilesY = (s_height + CPU_TILE - 1) / CPU_TILE;
+
+  // Frame streams laid out instance after instance, split into stealable chunks
+  int numInstances = scene->numInstances;
+  int totalVerts = 0, totalTriangles = 0;
+  if (s_vertexChunks) arrdeln(s_vertexChunks, 0, arrlen(s_vertexChunks));
+  if (s_triangleChunks) arrdeln(s_triangleChunks, 0, arrlen(s_triangleChunks));
+  if (numInstances > 0)
+  {
+    arrsetlen(s_instanceClip, numInstances);
+    arrsetlen(s_vertexBase, numInstances);
+  }
+
+  f4x4 viewProjection = MatMul(scene->projection, scene->view);
+  for (int i = 0; i < numInstances; i++)
+  {
+    const CpuInstance* inst = &scene->instances[i];
+    s_instanceClip[i] = inst->transform;
+    s_vertexBase[i] = totalVerts;
+    cpu_add_chunks(&s_vertexChunks, i, inst->vertexCount, CPU_VERTEX_CHUNK, totalVerts);
+    cpu_add_chunks(&s_triangleChunks, i, inst->triangleCount, CPU_TRIANGLE_CHUNK, totalTriangles);
+    totalVerts += inst->vertexCount;
+    totalTriangles += inst->triangleCount;
+  }
+  MatMulArray(&viewProjection, s_instanceClip, s_instanceClip, numInstances);
+  if (totalVerts > 0) arrsetlen(s_projected, totalVerts);
+  if (totalTriangles > 0) arrsetlen(s_setup, totalTriangles);
+
+  cpu_parallel_for((int)arrlen(s_vertexChunks), cpu_vertex_task, (void*)scene);
+  double vertexDone = cpu_now_ms();
+
+  for (int w = 0; w < s_numWorkers; w++)
+    for (int t = 0; t < s_tilesX * s_tilesY; t++)
+      s_bins[w][t].count = 0;
+  cpu_parallel_for((int)arrlen(s_triangleChunks), cpu_setup_task, (void*)scene);
+  double setupDone = cpu_now_ms();
+
+  cpu_parallel_for(s_tilesX * s_tilesY, cpu_tile_task, (void*)scene);
+  double fragmentDone = cpu_now_ms();
+
+  stageMs[STAGE_VERTEX] = (float)(vertexDone - start);
+  stageMs[STAGE_SETUP] = (float)(setupDone - vertexDone); // binning happens in the same pass
+  stageMs[STAGE_FRAGMENT] = (float)(fragmentDone - setupDone);
+}
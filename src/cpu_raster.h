@@ -0,0 +1,37 @@
+#pragma once
+
+#include "engine.h"
+#include <stdbool.h>
+
+// Native rasterizer used when no OpenCL device is available (or --native),
+// engine.c feeds it the same mesh arrays the kernels read
+
+// One visible instance, the subset of CustomModel in engine.c it needs
+typedef struct {
+    int meshTriangleOffset;
+    int triangleCount;
+    int meshVertexOffset;
+    int vertexCount;
+    int pixelOffset;
+    int texWidth;
+    int texHeight;
+    f4x4 transform;
+} CpuInstance;
+
+typedef struct {
+    const Triangle* triangles;
+    const Vertex* vertices;
+    const Color* texels;
+    const CpuInstance* instances;
+    int numInstances;
+    f4x4 view;
+    f4x4 projection;
+    bool lighting;
+    Color background;
+    int width;  // render size, at most the cpu_raster_init size
+    int height;
+} CpuScene;
+
+bool cpu_raster_init(int width, int height, int threads);
+void cpu_raster_render(const CpuScene* scene, Color* target, float stageMs[STAGE_COUNT]); // vertex, setup and fragment times
+void cpu_raster_shutdown();
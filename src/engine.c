@@ -1,4 +1,7 @@
 #include "engine.h"
+#include "cpu_raster.h"
+#include "mesh_lod.h"
+#include "file_map.h"
 #include "CL/cl.h"
 #include "CL/cl_platform.h"
 #include "raylib.h"
@@ -12,35 +15,200 @@
 #include <assimp/postprocess.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#define engine_mkdir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define engine_mkdir(path) mkdir(path, 0755)
+#endif
+
+#define TILE_SIZE 16
+#define TILE_MAX_TRIS 1024
+#define SCAN_BLOCK 256
+#define HIZ_GROUP 4 // tiles per edge of a coarse depth bound cell
+#define MAX_DEVICES 8
+#define FRAME_SLOTS 2
+#define TEX_BLOCK 8 // texture block edge, must match shapes.cl
+#define BVH_LEAF_SIZE 4
+#define MAX_LOAD_THREADS 16
+#define MAX_FRAME_EVENTS 16
+#define STAGING_MIN_SIZE (64 * 1024) // per-slot block for the per-frame uploads
+#define STATS_WINDOW 120
+#define MAX_ENUMERATED_DEVICES 64
+#define KERNEL_CACHE_DIR "kernel_cache"
+#define ASSET_CACHE_DIR "asset_cache"
+#define ASSET_CACHE_VERSION 2
+#define LOD_TRIANGLE_PIXELS 8.0f // screen pixels a triangle of the chosen level may cover
+#define LOD_HYSTERESIS 1.25f     // a coarser level needs this much headroom before it is picked
+
+// fragment_kernel is specialized per TEXTURE_MODE (3) x LIGHTING (2)
+#define TEXTURE_MODE_ANY 0
+#define TEXTURE_MODE_ALL 1
+#define TEXTURE_MODE_NONE 2
+#define FRAGMENT_VARIANTS 6
+#define VISIBILITY_LANES 16 // work-items sharing one triangle in the visibility pass
+
+// Light clusters: CLUSTER_TILE pixel squares x CLUSTER_SLICES exponential depth slices
+#define CLUSTER_TILE 64
+#define CLUSTER_SLICES 16
+#define CLUSTER_MAX_LIGHTS 64
 
-static cl_platform_id s_platform;
-static cl_device_id s_device;
-static cl_program s_program;
-static cl_context s_context;
-static cl_command_queue s_queue;
-static cl_int s_err;
+typedef struct {
+  cl_event event;
+  EngineStage stage;
+} StageEvent;
+
+typedef struct {
+  int frame;
+  float ms[STAGE_COUNT];
+} FrameRecord;
+
+typedef struct {
+  int device;
+  EngineStage stage;
+  cl_ulong start;
+  cl_ulong end;
+} TraceRecord;
+
+typedef struct {
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_context context;
+  cl_command_queue queue;
+  cl_command_queue readQueue; // framebuffer readback overlaps the next frame's kernels
+  cl_program program;
+
+  cl_kernel clearKernel;
+  cl_kernel vertexKernel;
+  cl_kernel fragmentKernel; // active entry of variantKernels
+  cl_program variantPrograms[FRAGMENT_VARIANTS];
+  cl_kernel variantKernels[FRAGMENT_VARIANTS];
+  cl_kernel resolveKernels[FRAGMENT_VARIANTS]; // visibility-buffer shading, same programs
+  cl_kernel visibilityKernel; // NULL without cl_khr_int64_extended_atomics
+  cl_kernel clearTilesKernel;
+  cl_kernel binKernel;
+  cl_kernel hizKernel;
+  cl_kernel hizReduceKernel;
+  cl_kernel lightBoundsKernel;
+  cl_kernel clusterLightsKernel;
+  cl_kernel setupKernel;
+  cl_kernel scanBlocksKernel;
+  cl_kernel scanBlockSumsKernel;
+  cl_kernel compactKernel;
+
+  cl_mem frameBuffers[FRAME_SLOTS];
+  cl_mem hostBuffers[FRAME_SLOTS]; // pinned, kept mapped at hostPixels
+  Color* hostPixels[FRAME_SLOTS];
+  cl_mem depthBuffer;
+  cl_mem visibilityBuffer; // packed depth and triangle per pixel, visibility mode only
+  cl_mem projectedVertsBuffer;
+  cl_mem projectionBuffer;
+  cl_mem viewBuffer;
+  cl_mem cameraPosBuffer;
+  cl_mem trianglesBuffer;
+  cl_mem verticesBuffer;
+  cl_mem pixelsBuffer;
+  cl_mem modelsBuffer;
+  cl_mem drawRangesBuffer;
+  cl_mem triMetaBuffer;
+  cl_mem tileCountsBuffer;
+  cl_mem tileTrisBuffer;
+  cl_mem tileDepthBuffer; // per-tile max depth bound from fully covering triangles
+  cl_mem hizGroupsBuffer; // int2 per HIZ_GROUP x HIZ_GROUP tiles, nearest and deepest of their bounds
+  cl_mem setupMetaBuffer;
+  cl_mem visibleFlagsBuffer;
+  cl_mem scanOffsetsBuffer;
+  cl_mem blockSumsBuffer;
+  cl_mem visibleCountBuffer;
+  cl_mem lightsBuffer;
+  cl_mem lightBoundsBuffer;   // screen rectangle and depth range per light
+  cl_mem clusterCountsBuffer;
+  cl_mem clusterLightsBuffer; // CLUSTER_MAX_LIGHTS light indices per cluster
+
+  // Split-frame band: framebuffer rows [rowStart, rowEnd) are rasterized here
+  int rowStart;
+  int rowEnd;
+  float share;
+
+  // Per slot: the band it was rendered with and every command it enqueued,
+  // fragmentEvents/readEvents point into frameEvents and are not owned
+  int slotRowStart[FRAME_SLOTS];
+  int slotRowEnd[FRAME_SLOTS];
+  StageEvent frameEvents[FRAME_SLOTS][MAX_FRAME_EVENTS];
+  int frameEventCount[FRAME_SLOTS];
+  cl_event fragmentEvents[FRAME_SLOTS];
+  cl_event readEvents[FRAME_SLOTS];
+
+  // Per-frame uploads are copied into their slot's staging block and written
+  // from there. The block is reused once stagingFence, its last write, is done
+  char* staging[FRAME_SLOTS];
+  size_t stagingSize[FRAME_SLOTS];
+  size_t stagingUsed[FRAME_SLOTS];
+  size_t stagingWanted[FRAME_SLOTS]; // bytes asked for since the reset, the block grows to it
+  cl_event stagingFence[FRAME_SLOTS];
+} RenderDevice;
 
-static cl_kernel s_clearKernel;
-static cl_kernel s_vertexKernel;
-static cl_kernel s_fragmentKernel;
-
-static cl_mem s_frameBuffer;
-static cl_mem s_depthBuffer;
-static cl_mem s_projectedVertsBuffer;
-static cl_mem s_fragPosBuffer;
-static cl_mem s_projectionBuffer;
-static cl_mem s_viewBuffer;
-static cl_mem s_cameraPosBuffer;
-static cl_mem s_trianglesBuffer;
-static cl_mem s_pixelsBuffer;
-static cl_mem s_modelsBuffer;
+typedef struct {
+  cl_platform_id platform;
+  cl_device_id device;
+  cl_device_type type;
+  char name[128];
+  char platformName[128];
+} DeviceEntry;
+
+static RenderDevice s_devices[MAX_DEVICES];
+static int s_deviceCount = 0;
+static char s_deviceSelection[256] = "";
+static cl_int s_err;
+static char* s_kernelSource = NULL;
 
 static Color s_backgroundColor;
-static size_t s_screenResolution[2];
+static size_t s_screenResolution[2]; // render resolution, below the output size with dynamic resolution
+static size_t s_outputResolution[2]; // window / saved frame size, every buffer is allocated for it
+static size_t s_pendingResolution[2]; // applied at the start of the next frame, 0 when unchanged
+static size_t s_slotResolution[FRAME_SLOTS][2];
+static size_t s_pixelResolution[2]; // what s_pixelBuffer holds, packed rows
+static float s_dynamicTargetMs = 0.0f; // 0 keeps the output resolution
+static float s_minResolutionScale = 0.5f;
+static float s_resolutionScale = 1.0f;
+static size_t s_numTiles;
+static size_t s_numHizGroups;
+static size_t s_numClusters;
 static Color* s_pixelBuffer = NULL;
+static unsigned int s_frameIndex = 0;
 static Texture2D s_outputTexture;
+static bool s_headless = false;
+static int s_textureMode = TEXTURE_MODE_ANY;
+
+static float s_stageHistory[STAGE_COUNT][STATS_WINDOW];
+static int s_historyCount = 0;
+static int s_historyHead = 0;
+static double s_hostMs = 0.0;
+static bool s_capturing = false;
+static FrameRecord* s_frameRecords = NULL;
+static TraceRecord* s_traceRecords = NULL;
+static cl_ulong s_traceBase[MAX_DEVICES];
+
+static const char* s_stageNames[STAGE_COUNT] = {
+  "clear", "vertex", "setup", "binning", "fragment", "readback", "host"
+};
+static bool s_lighting = true;
+static bool s_packedVertices = false;
+static bool s_meshLods = false; // imports build a LOD chain, instances pick a level per frame
+static bool s_visibilityMode = false;
+static bool s_nativeBackend = false; // cpu_raster.c renders, no OpenCL devices
+static float s_nativeStageMs[STAGE_COUNT];
 
 typedef struct 
 {
@@ -69,182 +237,2522 @@ typedef struct
 
 static CustomCamera s_camera = {0};
 
+// Camera the frame being submitted renders with, s_camera keeps moving meanwhile
+typedef struct {
+  f3 position;
+  f4x4 view;
+} FrameView;
+
+static FrameView s_frameView = {0};
+
+// Frame pipeline, see engine_pipeline_start
+#define PIPELINE_MAX_DEPTH 4
+
+static bool s_pipelineRunning = false;
+static bool s_pipelineStop = false;
+static thrd_t s_pipelineThread;
+static mtx_t s_sceneMutex;   // recursive, held by the submit thread while it reads the scene
+static mtx_t s_presentMutex; // s_pixelBuffer
+static mtx_t s_queueMutex;
+static cnd_t s_queueChanged;
+static FrameView s_frameQueue[PIPELINE_MAX_DEPTH];
+static int s_queueHead = 0;
+static int s_queueCount = 0;
+static int s_pipelineDepth = 1;
+static unsigned int s_framesFinished = 0;  // frames landed in s_pixelBuffer
+static unsigned int s_framesPresented = 0;
+
+static EngineLight* s_lights = NULL;
+static size_t s_lightCapacity = 0;
+static bool s_lightsDirty = false;
+
+// One placed copy of a mesh, meshTriangleOffset/meshVertexOffset index the
+// shared mesh data that every instance of the same mesh reads
 typedef struct {
-    int triangleOffset;
     int triangleCount;
-    int vertexOffset;
     int vertexCount;
+    int meshTriangleOffset;
+    int meshVertexOffset;
     int pixelOffset;
     int texWidth;
     int texHeight;
+    int texLevels;
+    f3 quantMin;   // packed positions decode to quantMin + q * quantScale
+    f3 quantScale;
     f4x4 transform;
 } CustomModel;
 
-typedef struct {
-    int triIndex;
-    int minX, maxX, minY, maxY; // bbox inclusive (in pixel coords)
-    f2 v0; f2 v1; f2 v2; // screen-space XY (pixels)
-    float z0, z1, z2; // pv.z (NDC mapped value used in your earlier depth calc)
-    float w0, w1, w2; // clip w (for perspective correction)
-    float invArea; // 1/area (screen-space edge function denom)
-    int modelIndex;
-    int texOffset;
-    int texW;
-    int texH;
-} TriMeta;
+// Compact twin of Vertex, 12 bytes instead of 32. Positions are quantized over
+// the mesh bounds, normals octahedral at 8 bits per axis, uvs half floats
+typedef struct {
+    uint16_t position[3];
+    uint16_t normal;
+    uint16_t uv[2];
+} PackedVertex;
+
+// A visible instance for this frame, offsets index the per-frame projected
+// vertex and set-up triangle streams
+typedef struct {
+    int model;
+    int vertexOffset;
+    int triangleOffset;
+} DrawRange;
+
+// Element capacities of the growable device buffers, the same on every device
+typedef struct {
+    size_t triangles;
+    size_t vertices;
+    size_t pixels;
+    size_t models;
+    size_t instanceVerts;
+    size_t instanceTris;
+    size_t scanBlocks;
+} BufferCapacity;
+
+// pixelOffset is the base level, the rest of the mip chain follows it
+typedef struct {
+    int pixelOffset;
+    int width;
+    int height;
+    int levels;
+} CustomTexture;
+
+typedef struct {
+    int triangleOffset;
+    int triangleCount;
+    int vertexOffset;
+    int vertexCount;
+    int texture; // -1 when untextured
+    f3 boundsMin; // object space
+    f3 boundsMax;
+    int lodCount; // lods[0] is the fields above, each further level about half the triangles
+    MeshLod lods[MESH_LOD_MAX];
+} CustomMesh;
+
+// World-space bounds of one instance, parallel to s_Models
+typedef struct {
+    f3 min;
+    f3 max;
+    f3 center;
+    float radius;
+} ModelBounds;
+
+// Every node covers s_bvhOrder[first, first + count), inner nodes have count
+// children split between left and right
+typedef struct {
+    f3 min;
+    f3 max;
+    int first;
+    int count;
+    int left;
+    int right;
+} BvhNode;
+
+typedef struct {
+    char* key;
+    int value;
+} AssetLookup;
+
+typedef struct {
+    int triIndex;
+    int minX, maxX, minY, maxY; // bbox inclusive (in pixel coords)
+    f2 v0; f2 v1; f2 v2; // screen-space XY (pixels)
+    float z0, z1, z2; // pv.z (NDC mapped value used in your earlier depth calc)
+    float w0, w1, w2; // clip w (for perspective correction)
+    float zMin, zMax; // rasterized depth range, used by the hi-Z tests
+    float invArea; // 1/area (screen-space edge function denom)
+    int modelIndex; // instance
+    int vertexOffset; // mesh vertex offset
+    int texOffset;
+    int texW;
+    int texH;
+    int texLevels;
+} TriMeta;
+
+static Triangle* s_allTriangles = NULL;
+static Vertex* s_allVertices = NULL;
+static PackedVertex* s_allPackedVertices = NULL; // what the devices get with packed vertices on
+static Color* s_allTexturePixels = NULL;
+static CustomModel* s_Models = NULL;
+static CustomMesh* s_meshes = NULL;
+static CustomTexture* s_textures = NULL;
+static AssetLookup* s_meshLookup = NULL;
+static AssetLookup* s_textureLookup = NULL;
+
+typedef enum {
+    LOAD_TEXTURE,
+    LOAD_MESH
+} LoadKind;
+
+// One import on the loader pool. Workers only fill the result fields, the
+// shared arrays are touched when the main thread merges the job
+typedef struct {
+    LoadKind kind;
+    char* path;
+    char* texturePath; // mesh jobs
+    int textureJob;    // mesh jobs: texture job it waits for, -1 if none
+    bool done;         // guarded by s_loadMutex
+    bool ok;
+    Vertex* vertices;  // stb_ds arrays, or views into cache when it is mapped
+    Triangle* triangles;
+    size_t numVertices; // every level, lods[0] is the import
+    size_t numTriangles;
+    int lodCount;
+    MeshLod lods[MESH_LOD_MAX]; // offsets into the job arrays
+    f3 boundsMin;
+    f3 boundsMax;
+    Color* pixels;     // whole mip chain, already swizzled
+    size_t numPixels;
+    int width;
+    int height;
+    int levels;
+    MappedFile cache;
+    int result;        // mesh or texture index once merged, -1 on failure
+} LoadJob;
+
+// Asset cache files are the header followed by the arrays exactly as they
+// are merged and uploaded, so a mapped file is used without parsing
+typedef struct {
+    char magic[4]; // "GABM"
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t numVertices;
+    uint64_t numTriangles;
+    f3 boundsMin;
+    f3 boundsMax;
+    uint32_t lodChain; // 1 when written with mesh LODs on, even if the mesh kept one level
+    uint32_t lodCount;
+    MeshLod lods[MESH_LOD_MAX];
+} MeshCacheHeader; // followed by Vertex[numVertices], Triangle[numTriangles], levels in lods order
+
+typedef struct {
+    char magic[4]; // "GABT"
+    uint32_t version;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t numPixels;
+    int32_t width;
+    int32_t height;
+    int32_t levels;
+    int32_t block;
+} TextureCacheHeader; // followed by Color[numPixels]
+
+// Instance to place once its mesh job is merged
+typedef struct {
+    int meshJob; // -1 when the mesh was already loaded
+    int mesh;
+    f4x4 transform;
+} LoadRequest;
+
+static thrd_t s_loadThreads[MAX_LOAD_THREADS];
+static int s_loadThreadCount = 0;
+static mtx_t s_loadMutex;
+static cnd_t s_loadWork;
+static cnd_t s_loadDone;
+static bool s_loadShutdown = false;
+static LoadJob** s_loadJobs = NULL; // submission order
+static int s_loadNextJob = 0;       // first job no worker has picked up
+static int s_loadMerged = 0;
+static LoadRequest* s_loadRequests = NULL;
+static int s_loadRequestsDone = 0;
+static AssetLookup* s_pendingMeshes = NULL;
+static AssetLookup* s_pendingTextures = NULL;
+
+static ModelBounds* s_modelBounds = NULL;
+static int* s_modelMeshes = NULL; // mesh of every instance, parallel to s_Models
+static int* s_modelLods = NULL;   // level every instance draws, parallel to s_Models
+static BvhNode* s_bvhNodes = NULL;
+static int* s_bvhOrder = NULL;
+static int s_bvhModels = 0;       // instances the BVH was built over
+static bool s_bvhDirty = false;   // bounds moved, refit before culling
+static unsigned char* s_modelVisible = NULL;
+static DrawRange* s_drawRanges = NULL;
+
+// What the devices already hold, engine_upload_models_data only sends the rest
+static BufferCapacity s_capacity = {0};
+static size_t s_uploadedTriangles = 0;
+static size_t s_uploadedVertices = 0;
+static size_t s_uploadedPixels = 0;
+static size_t s_uploadedModels = 0;
+static int s_dirtyFirst = INT_MAX; // span of instances with changed transforms
+static int s_dirtyLast = -1;
+
+// Totals over instances size the per-instance buffers, the frame counts cover
+// only the instances that survived culling and are what gets dispatched
+static size_t s_totalTriangles = 0;
+static size_t s_totalVerts = 0;
+static size_t s_frameTriangles = 0;
+static size_t s_frameVerts = 0;
+static size_t s_paddedTriangles = 0;
+
+static const char* engine_load_kernel(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if(!f) { printf("Cannot open kernel file.\n"); return NULL; }
+  fseek(f,0,SEEK_END);
+  size_t size = ftell(f);
+  fseek(f,0,SEEK_SET);
+  char* src = (char*)malloc(size+1);
+  fread(src,1,size,f);
+  src[size] = '\0';
+  fclose(f);
+  return src;
+}
+
+static int engine_enumerate_devices(DeviceEntry* entries, int maxEntries)
+{
+  cl_platform_id platforms[16];
+  cl_uint numPlatforms = 0;
+  if (clGetPlatformIDs(16, platforms, &numPlatforms) != CL_SUCCESS) return 0;
+  if (numPlatforms > 16) numPlatforms = 16;
+
+  int count = 0;
+  for (cl_uint p = 0; p < numPlatforms; p++)
+  {
+    cl_device_id devices[16];
+    cl_uint numDevices = 0;
+    if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 16, devices, &numDevices) != CL_SUCCESS) continue;
+    if (numDevices > 16) numDevices = 16;
+
+    for (cl_uint d = 0; d < numDevices && count < maxEntries; d++)
+    {
+      DeviceEntry* e = &entries[count++];
+      e->platform = platforms[p];
+      e->device = devices[d];
+      clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(e->type), &e->type, NULL);
+      clGetDeviceInfo(devices[d], CL_DEVICE_NAME, sizeof(e->name), e->name, NULL);
+      clGetPlatformInfo(platforms[p], CL_PLATFORM_NAME, sizeof(e->platformName), e->platformName, NULL);
+    }
+  }
+  return count;
+}
+
+static const char* engine_device_type_name(cl_device_type type)
+{
+  if (type & CL_DEVICE_TYPE_GPU) return "GPU";
+  if (type & CL_DEVICE_TYPE_CPU) return "CPU";
+  if (type & CL_DEVICE_TYPE_ACCELERATOR) return "Accelerator";
+  return "Other";
+}
+
+static bool engine_contains_nocase(const char* haystack, const char* needle)
+{
+  size_t n = strlen(needle);
+  for (; *haystack; haystack++)
+  {
+    size_t i = 0;
+    while (i < n && haystack[i] && tolower((unsigned char)haystack[i]) == tolower((unsigned char)needle[i])) i++;
+    if (i == n) return true;
+  }
+  return false;
+}
+
+void engine_list_devices()
+{
+  DeviceEntry entries[MAX_ENUMERATED_DEVICES];
+  int count = engine_enumerate_devices(entries, MAX_ENUMERATED_DEVICES);
+  if (count == 0) { printf("No OpenCL devices found.\n"); return; }
+
+  for (int i = 0; i < count; i++)
+    printf("[%d] %s (%s) - %s\n", i, entries[i].name,
+           engine_device_type_name(entries[i].type), entries[i].platformName);
+}
+
+void engine_select_devices(const char* selection)
+{
+  snprintf(s_deviceSelection, sizeof(s_deviceSelection), "%s", selection ? selection : "");
+}
+
+void engine_set_packed_vertices(bool enabled)
+{
+  s_packedVertices = enabled;
+}
+
+void engine_set_visibility_buffer(bool enabled)
+{
+  s_visibilityMode = enabled;
+}
+
+void engine_set_native_backend(bool enabled)
+{
+  s_nativeBackend = enabled;
+}
+
+void engine_set_mesh_lods(bool enabled)
+{
+  s_meshLods = enabled;
+}
+
+// Resolves the engine_select_devices() list, or the first device of deviceType
+// when nothing was selected. Returns the number of devices written to picked.
+static int engine_pick_devices(DeviceEntry* picked, cl_device_type deviceType)
+{
+  DeviceEntry entries[MAX_ENUMERATED_DEVICES];
+  bool used[MAX_ENUMERATED_DEVICES] = {0};
+  int count = engine_enumerate_devices(entries, MAX_ENUMERATED_DEVICES);
+  int numPicked = 0;
+
+  if (s_deviceSelection[0] == '\0')
+  {
+    for (int i = 0; i < count; i++)
+    {
+      if (entries[i].type & deviceType) { picked[numPicked++] = entries[i]; break; }
+    }
+    return numPicked;
+  }
+
+  char selection[sizeof(s_deviceSelection)];
+  memcpy(selection, s_deviceSelection, sizeof(selection));
+
+  for (char* token = strtok(selection, ","); token && numPicked < MAX_DEVICES; token = strtok(NULL, ","))
+  {
+    char* end;
+    long index = strtol(token, &end, 10);
+    int match = -1;
+
+    if (end != token && *end == '\0')
+    {
+      if (index >= 0 && index < count && !used[index]) match = (int)index;
+    }
+    else
+    {
+      for (int i = 0; i < count && match < 0; i++)
+      {
+        if (!used[i] && (engine_contains_nocase(entries[i].name, token) ||
+                         engine_contains_nocase(entries[i].platformName, token)))
+          match = i;
+      }
+    }
+
+    if (match < 0) { printf("No OpenCL device matches \"%s\"\n", token); continue; }
+    used[match] = true;
+    picked[numPicked++] = entries[match];
+  }
+  return numPicked;
+}
+
+// Splits the framebuffer rows between devices by their current share,
+// band edges snap to tile rows so no tile is binned on two devices
+static void engine_assign_rows()
+{
+  int height = (int)s_screenResolution[1];
+  int row = 0;
+  float accum = 0.0f;
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    accum += dev->share;
+
+    int end = d == s_deviceCount - 1 ? height : (int)(accum * height + 0.5f) / TILE_SIZE * TILE_SIZE;
+    if (end < row) end = row;
+    if (end > height) end = height;
+
+    dev->rowStart = row;
+    dev->rowEnd = end;
+    row = end;
+
+    clSetKernelArg(dev->setupKernel, 9, sizeof(int), &dev->rowStart);
+    clSetKernelArg(dev->setupKernel, 10, sizeof(int), &dev->rowEnd);
+  }
+}
+
+static double engine_now_ms()
+{
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec * 1e-6;
+}
+
+// Hands out the event slot for the next command of the frame in slot,
+// the command is attributed to stage in the profiling stats
+static cl_event* engine_stage_event(RenderDevice* dev, int slot, EngineStage stage)
+{
+  if (dev->frameEventCount[slot] >= MAX_FRAME_EVENTS) return NULL;
+
+  StageEvent* e = &dev->frameEvents[slot][dev->frameEventCount[slot]++];
+  e->event = NULL;
+  e->stage = stage;
+  return &e->event;
+}
+
+static void engine_reset_stage_events(RenderDevice* dev, int slot)
+{
+  for (int i = 0; i < dev->frameEventCount[slot]; i++)
+    if (dev->frameEvents[slot][i].event) clReleaseEvent(dev->frameEvents[slot][i].event);
+
+  dev->frameEventCount[slot] = 0;
+  dev->fragmentEvents[slot] = NULL;
+  dev->readEvents[slot] = NULL;
+}
+
+static void engine_event_times(cl_event event, cl_ulong* start, cl_ulong* end)
+{
+  *start = *end = 0;
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(*start), start, NULL);
+  clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(*end), end, NULL);
+}
+
+// Picks the render resolution for the frame time target. Fragment cost follows
+// the pixel count, so the scale moves by the square root of the time ratio
+static void engine_update_resolution(const float ms[STAGE_COUNT])
+{
+  float deviceMs = ms[STAGE_CLEAR] + ms[STAGE_VERTEX] + ms[STAGE_SETUP] + ms[STAGE_BINNING] + ms[STAGE_FRAGMENT];
+  if (deviceMs <= 0.0f) return;
+
+  float desired = s_resolutionScale * sqrtf(s_dynamicTargetMs / deviceMs);
+  desired = fminf(fmaxf(desired, s_minResolutionScale), 1.0f);
+  s_resolutionScale += 0.25f * (desired - s_resolutionScale); // damped, a single slow frame barely moves it
+
+  // Multiples of 8 pixels, and only steps of 2+ so the size does not flicker
+  size_t width = (size_t)(s_outputResolution[0] * s_resolutionScale) / 8 * 8;
+  size_t height = (size_t)(s_outputResolution[1] * s_resolutionScale) / 8 * 8;
+  width = width < TILE_SIZE ? TILE_SIZE : width > s_outputResolution[0] ? s_outputResolution[0] : width;
+  height = height < TILE_SIZE ? TILE_SIZE : height > s_outputResolution[1] ? s_outputResolution[1] : height;
+  if (s_resolutionScale >= 0.999f) { width = s_outputResolution[0]; height = s_outputResolution[1]; }
+
+  size_t dx = width > s_screenResolution[0] ? width - s_screenResolution[0] : s_screenResolution[0] - width;
+  size_t dy = height > s_screenResolution[1] ? height - s_screenResolution[1] : s_screenResolution[1] - height;
+  if (dx >= 16 || dy >= 16 || (width == s_outputResolution[0] && height == s_outputResolution[1]))
+  {
+    s_pendingResolution[0] = width;
+    s_pendingResolution[1] = height;
+  }
+}
+
+// Folds the finished frame in slot into the rolling window, each stage takes
+// the slowest device since split-frame devices run side by side
+static void engine_collect_stats(int slot)
+{
+  float ms[STAGE_COUNT] = {0};
+  if (s_nativeBackend) memcpy(ms, s_nativeStageMs, sizeof(ms));
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    float deviceMs[STAGE_COUNT] = {0};
+
+    for (int i = 0; i < dev->frameEventCount[slot]; i++)
+    {
+      StageEvent* e = &dev->frameEvents[slot][i];
+      if (!e->event) continue;
+
+      cl_ulong start, end;
+      engine_event_times(e->event, &start, &end);
+      if (end > start) deviceMs[e->stage] += (float)(end - start) * 1e-6f;
+
+      if (s_capturing)
+      {
+        if (s_traceBase[d] == 0 || start < s_traceBase[d]) s_traceBase[d] = start;
+        TraceRecord record = { d, e->stage, start, end };
+        arrpush(s_traceRecords, record);
+      }
+    }
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++)
+      if (deviceMs[stage] > ms[stage]) ms[stage] = deviceMs[stage];
+  }
+  ms[STAGE_HOST] = (float)s_hostMs;
+  s_hostMs = 0.0;
+  if (s_dynamicTargetMs > 0.0f) engine_update_resolution(ms);
+
+  for (int stage = 0; stage < STAGE_COUNT; stage++)
+    s_stageHistory[stage][s_historyHead] = ms[stage];
+  s_historyHead = (s_historyHead + 1) % STATS_WINDOW;
+  if (s_historyCount < STATS_WINDOW) s_historyCount++;
+
+  if (s_capturing)
+  {
+    FrameRecord record = { (int)arrlen(s_frameRecords), {0} };
+    memcpy(record.ms, ms, sizeof(ms));
+    arrpush(s_frameRecords, record);
+  }
+}
+
+static int engine_compare_floats(const void* a, const void* b)
+{
+  float fa = *(const float*)a, fb = *(const float*)b;
+  return (fa > fb) - (fa < fb);
+}
+
+EngineStats engine_get_stats()
+{
+  EngineStats stats = {0};
+  stats.frames = s_historyCount;
+  stats.triangles = s_frameTriangles;
+  if (s_historyCount == 0) return stats;
+
+  float sorted[STATS_WINDOW];
+  for (int stage = 0; stage < STAGE_COUNT; stage++)
+  {
+    float sum = 0.0f;
+    for (int i = 0; i < s_historyCount; i++)
+    {
+      sorted[i] = s_stageHistory[stage][i];
+      sum += sorted[i];
+    }
+    qsort(sorted, s_historyCount, sizeof(float), engine_compare_floats);
+
+    int p99 = (int)ceilf(0.99f * s_historyCount) - 1;
+    stats.stages[stage].min = sorted[0];
+    stats.stages[stage].avg = sum / s_historyCount;
+    stats.stages[stage].p99 = sorted[p99 < 0 ? 0 : p99];
+    stats.stages[stage].last = s_stageHistory[stage][(s_historyHead + STATS_WINDOW - 1) % STATS_WINDOW];
+  }
+  return stats;
+}
+
+void engine_print_stats()
+{
+  EngineStats stats = engine_get_stats();
+  printf("%-9s %8s %8s %8s   (ms over %d frames)\n", "stage", "min", "avg", "p99", stats.frames);
+  for (int stage = 0; stage < STAGE_COUNT; stage++)
+    printf("%-9s %8.3f %8.3f %8.3f\n", s_stageNames[stage],
+           stats.stages[stage].min, stats.stages[stage].avg, stats.stages[stage].p99);
+}
+
+void engine_stats_capture(bool enabled)
+{
+  s_capturing = enabled;
+  if (!enabled) return;
+
+  arrfree(s_frameRecords);
+  arrfree(s_traceRecords);
+  memset(s_traceBase, 0, sizeof(s_traceBase));
+}
+
+bool engine_stats_write_csv(const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) { printf("Cannot open stats file: %s\n", path); return false; }
+
+  fprintf(f, "frame");
+  for (int stage = 0; stage < STAGE_COUNT; stage++) fprintf(f, ",%s_ms", s_stageNames[stage]);
+  fprintf(f, "\n");
+
+  for (int i = 0; i < arrlen(s_frameRecords); i++)
+  {
+    fprintf(f, "%d", s_frameRecords[i].frame);
+    for (int stage = 0; stage < STAGE_COUNT; stage++) fprintf(f, ",%.4f", s_frameRecords[i].ms[stage]);
+    fprintf(f, "\n");
+  }
+
+  fclose(f);
+  return true;
+}
+
+// Chrome trace event format (chrome://tracing, Perfetto), one track per device
+bool engine_stats_write_trace(const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (!f) { printf("Cannot open trace file: %s\n", path); return false; }
+
+  fprintf(f, "{\"traceEvents\":[\n");
+  for (int i = 0; i < arrlen(s_traceRecords); i++)
+  {
+    TraceRecord* r = &s_traceRecords[i];
+    double ts = (double)(r->start - s_traceBase[r->device]) * 1e-3;
+    double dur = r->end > r->start ? (double)(r->end - r->start) * 1e-3 : 0.0;
+    fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+            i ? "," : "", s_stageNames[r->stage], r->device, ts, dur);
+  }
+  fprintf(f, "]}\n");
+
+  fclose(f);
+  return true;
+}
+
+// Moves rows towards the devices that finished their last band fastest,
+// timings come from the frame rendered into the given slot
+static void engine_balance_devices(int slot)
+{
+  if (s_deviceCount < 2) return;
+
+  float speed[MAX_DEVICES];
+  float totalSpeed = 0.0f;
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    speed[d] = 0.0f;
+
+    // Clear start to fragment end, the readback overlaps the next frame
+    cl_ulong first = 0, last = 0;
+    for (int i = 0; i < dev->frameEventCount[slot]; i++)
+    {
+      StageEvent* e = &dev->frameEvents[slot][i];
+      if (!e->event || e->stage == STAGE_READBACK) continue;
+
+      cl_ulong start, end;
+      engine_event_times(e->event, &start, &end);
+      if (first == 0 || start < first) first = start;
+      if (end > last) last = end;
+    }
+    if (last <= first) continue;
+
+    float ms = (float)(last - first) * 1e-6f;
+    speed[d] = (float)(dev->slotRowEnd[slot] - dev->slotRowStart[slot]) / ms;
+    totalSpeed += speed[d];
+  }
+  if (totalSpeed <= 0.0f) return;
+
+  float totalShare = 0.0f;
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    dev->share = 0.8f * dev->share + 0.2f * (speed[d] / totalSpeed);
+    if (dev->share < 0.05f) dev->share = 0.05f;
+    totalShare += dev->share;
+  }
+  for (int d = 0; d < s_deviceCount; d++)
+    s_devices[d].share /= totalShare;
+
+  engine_assign_rows();
+}
+
+static uint64_t engine_hash(uint64_t hash, const char* str)
+{
+  // FNV-1a, strings are hashed with their terminator so "ab"+"c" != "a"+"bc"
+  do { hash = (hash ^ (unsigned char)*str) * 1099511628211ull; } while (*str++);
+  return hash;
+}
+
+// Cache file for this source + options on this exact device and driver
+static void engine_kernel_cache_path(RenderDevice* dev, const char* source, const char* options,
+                                     char* path, size_t pathSize)
+{
+  char name[256] = "", vendor[256] = "", driver[256] = "", version[256] = "";
+  clGetDeviceInfo(dev->device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  clGetDeviceInfo(dev->device, CL_DEVICE_VENDOR, sizeof(vendor), vendor, NULL);
+  clGetDeviceInfo(dev->device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+  clGetDeviceInfo(dev->device, CL_DEVICE_VERSION, sizeof(version), version, NULL);
+
+  uint64_t hash = 14695981039346656037ull;
+  hash = engine_hash(hash, source);
+  hash = engine_hash(hash, options);
+  hash = engine_hash(hash, name);
+  hash = engine_hash(hash, vendor);
+  hash = engine_hash(hash, driver);
+  hash = engine_hash(hash, version);
+
+  snprintf(path, pathSize, KERNEL_CACHE_DIR "/%016llx.bin", (unsigned long long)hash);
+}
+
+static cl_program engine_load_cached_program(RenderDevice* dev, const char* path, const char* options)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  size_t size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  unsigned char* binary = (unsigned char*)malloc(size);
+  size_t read = fread(binary, 1, size, f);
+  fclose(f);
+  if (read != size || size == 0) { free(binary); return NULL; }
+
+  cl_int binaryStatus = CL_SUCCESS;
+  const unsigned char* binaries[1] = { binary };
+  cl_program program = clCreateProgramWithBinary(dev->context, 1, &dev->device, &size,
+                                                 binaries, &binaryStatus, &s_err);
+  free(binary);
+  if (s_err != CL_SUCCESS || binaryStatus != CL_SUCCESS) return NULL;
+
+  if (clBuildProgram(program, 1, &dev->device, options, NULL, NULL) != CL_SUCCESS)
+  {
+    clReleaseProgram(program);
+    return NULL;
+  }
+  return program;
+}
+
+static void engine_store_cached_program(RenderDevice* dev, cl_program program, const char* path)
+{
+  size_t size = 0;
+  clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL);
+  if (size == 0) return;
+
+  unsigned char* binary = (unsigned char*)malloc(size);
+  unsigned char* binaries[1] = { binary };
+  if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) == CL_SUCCESS)
+  {
+    engine_mkdir(KERNEL_CACHE_DIR);
+    FILE* f = fopen(path, "wb");
+    if (f) { fwrite(binary, 1, size, f); fclose(f); }
+  }
+  free(binary);
+}
+
+// Loads the program binary cached for this device, falling back to a source
+// build (and refreshing the cache) when there is none or the driver rejects it
+static cl_program engine_build_program(RenderDevice* dev, const char* source, const char* options)
+{
+  char path[512];
+  engine_kernel_cache_path(dev, source, options, path, sizeof(path));
+
+  cl_program program = engine_load_cached_program(dev, path, options);
+  if (program) return program;
+
+  program = clCreateProgramWithSource(dev->context, 1, &source, NULL, &s_err);
+  if (s_err != CL_SUCCESS) { printf("Error creating program: %d\n", s_err); }
+
+  s_err = clBuildProgram(program, 1, &dev->device, options, NULL, NULL);
+  if (s_err != CL_SUCCESS) {
+      size_t log_size;
+      clGetProgramBuildInfo(program, dev->device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
+      char* log = (char*)malloc(log_size);
+      clGetProgramBuildInfo(program, dev->device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
+      printf("OpenCL build error:\n%s\n", log);
+      free(log);
+      return program;
+  }
+
+  engine_store_cached_program(dev, program, path);
+  return program;
+}
+
+static int engine_fragment_variant(int textureMode, bool lighting)
+{
+  return textureMode * 2 + (lighting ? 1 : 0);
+}
+
+static void engine_build_options(char* options, size_t size, int textureMode, bool lighting)
+{
+  // Sizes stay kernel arguments when the render resolution changes at runtime
+  char resolution[64] = "";
+  if (s_dynamicTargetMs <= 0.0f)
+    snprintf(resolution, sizeof(resolution), " -DSCREEN_WIDTH=%d -DSCREEN_HEIGHT=%d",
+             (int)s_screenResolution[0], (int)s_screenResolution[1]);
+
+  snprintf(options, size,
+           "-DTILE_SIZE=%d -DTILE_MAX_TRIS=%d -DSCAN_BLOCK=%d -DHIZ_GROUP=%d"
+           " -DCLUSTER_TILE=%d -DCLUSTER_SLICES=%d -DCLUSTER_MAX_LIGHTS=%d"
+           "%s -DTEXTURE_MODE=%d -DLIGHTING=%d -DPACKED_VERTICES=%d",
+           TILE_SIZE, TILE_MAX_TRIS, SCAN_BLOCK, HIZ_GROUP, CLUSTER_TILE, CLUSTER_SLICES, CLUSTER_MAX_LIGHTS,
+           resolution, textureMode, lighting ? 1 : 0, s_packedVertices ? 1 : 0);
+}
+
+// Every fragment argument except the framebuffer, which follows the frame slot
+static void engine_bind_fragment_args(RenderDevice* dev, cl_kernel kernel)
+{
+  clSetKernelArg(kernel, 1, sizeof(int), &s_screenResolution[0]);
+  clSetKernelArg(kernel, 2, sizeof(int), &s_screenResolution[1]);
+  clSetKernelArg(kernel, 3, sizeof(cl_mem), &dev->depthBuffer);
+  clSetKernelArg(kernel, 4, sizeof(cl_mem), &dev->cameraPosBuffer);
+  clSetKernelArg(kernel, 5, sizeof(cl_mem), &dev->trianglesBuffer);
+  clSetKernelArg(kernel, 6, sizeof(cl_mem), &dev->verticesBuffer);
+  clSetKernelArg(kernel, 7, sizeof(cl_mem), &dev->pixelsBuffer);
+  clSetKernelArg(kernel, 8, sizeof(cl_mem), &dev->triMetaBuffer);
+  clSetKernelArg(kernel, 9, sizeof(cl_mem), &dev->visibleCountBuffer);
+  clSetKernelArg(kernel, 10, sizeof(cl_mem), &dev->tileCountsBuffer);
+  clSetKernelArg(kernel, 11, sizeof(cl_mem), &dev->tileTrisBuffer);
+  clSetKernelArg(kernel, 12, sizeof(cl_mem), &dev->tileDepthBuffer);
+  clSetKernelArg(kernel, 13, sizeof(cl_mem), &dev->modelsBuffer);
+  clSetKernelArg(kernel, 14, sizeof(cl_mem), &dev->lightsBuffer);
+  clSetKernelArg(kernel, 15, sizeof(cl_mem), &dev->clusterCountsBuffer);
+  clSetKernelArg(kernel, 16, sizeof(cl_mem), &dev->clusterLightsBuffer);
+  clSetKernelArg(kernel, 17, sizeof(float), &s_camera.near_plane);
+  clSetKernelArg(kernel, 18, sizeof(float), &s_camera.far_plane);
+}
+
+static void engine_bind_resolve_args(RenderDevice* dev, cl_kernel kernel)
+{
+  clSetKernelArg(kernel, 1, sizeof(int), &s_screenResolution[0]);
+  clSetKernelArg(kernel, 2, sizeof(int), &s_screenResolution[1]);
+  clSetKernelArg(kernel, 3, sizeof(cl_mem), &dev->visibilityBuffer);
+  clSetKernelArg(kernel, 4, sizeof(cl_mem), &dev->trianglesBuffer);
+  clSetKernelArg(kernel, 5, sizeof(cl_mem), &dev->verticesBuffer);
+  clSetKernelArg(kernel, 6, sizeof(cl_mem), &dev->pixelsBuffer);
+  clSetKernelArg(kernel, 7, sizeof(cl_mem), &dev->triMetaBuffer);
+  clSetKernelArg(kernel, 8, sizeof(cl_mem), &dev->modelsBuffer);
+  clSetKernelArg(kernel, 9, sizeof(cl_mem), &dev->lightsBuffer);
+  clSetKernelArg(kernel, 10, sizeof(cl_mem), &dev->clusterCountsBuffer);
+  clSetKernelArg(kernel, 11, sizeof(cl_mem), &dev->clusterLightsBuffer);
+  clSetKernelArg(kernel, 12, sizeof(float), &s_camera.near_plane);
+  clSetKernelArg(kernel, 13, sizeof(float), &s_camera.far_plane);
+}
+
+// Rebinds the shading kernels of every variant built so far
+static void engine_bind_variant_args(RenderDevice* dev)
+{
+  for (int v = 0; v < FRAGMENT_VARIANTS; v++)
+  {
+    if (dev->variantKernels[v]) engine_bind_fragment_args(dev, dev->variantKernels[v]);
+    if (dev->resolveKernels[v]) engine_bind_resolve_args(dev, dev->resolveKernels[v]);
+  }
+}
+
+// Points fragmentKernel at the variant matching the current scene and
+// settings, building it (or loading it from the kernel cache) on first use.
+// With the visibility buffer the variant's resolve pass takes its place
+static void engine_use_fragment_variant(RenderDevice* dev)
+{
+  int variant = engine_fragment_variant(s_textureMode, s_lighting);
+
+  if (!dev->variantKernels[variant])
+  {
+    char buildOptions[256];
+    engine_build_options(buildOptions, sizeof(buildOptions), s_textureMode, s_lighting);
+    dev->variantPrograms[variant] = engine_build_program(dev, s_kernelSource, buildOptions);
+    dev->variantKernels[variant] = clCreateKernel(dev->variantPrograms[variant], "fragment_kernel", &s_err);
+    if (s_err != CL_SUCCESS) { printf("Error creating fragment variant %d: %d\n", variant, s_err); return; }
+    dev->resolveKernels[variant] = clCreateKernel(dev->variantPrograms[variant], "resolve_kernel", &s_err);
+
+    engine_bind_fragment_args(dev, dev->variantKernels[variant]);
+    if (dev->resolveKernels[variant]) engine_bind_resolve_args(dev, dev->resolveKernels[variant]);
+  }
+
+  dev->fragmentKernel = dev->visibilityBuffer && dev->resolveKernels[variant] ? dev->resolveKernels[variant]
+                                                                              : dev->variantKernels[variant];
+}
+
+// Scene changes from the main thread wait for the submit thread to finish
+// reading the scene, no-ops while the pipeline is off
+static void engine_scene_lock()
+{
+  if (s_pipelineRunning) mtx_lock(&s_sceneMutex);
+}
+
+static void engine_scene_unlock()
+{
+  if (s_pipelineRunning) mtx_unlock(&s_sceneMutex);
+}
+
+void engine_set_lighting(bool enabled)
+{
+  engine_scene_lock();
+  s_lighting = enabled;
+  engine_scene_unlock();
+}
+
+int engine_add_light(EngineLight light)
+{
+  engine_scene_lock();
+  arrpush(s_lights, light);
+  s_lightsDirty = true;
+  int index = (int)arrlen(s_lights) - 1;
+  engine_scene_unlock();
+  return index;
+}
+
+void engine_set_light(int index, EngineLight light)
+{
+  if (index < 0 || index >= arrlen(s_lights)) return;
+  engine_scene_lock();
+  s_lights[index] = light;
+  s_lightsDirty = true;
+  engine_scene_unlock();
+}
+
+void engine_clear_lights()
+{
+  engine_scene_lock();
+  arrfree(s_lights);
+  s_lightsDirty = true;
+  engine_scene_unlock();
+}
+
+// Every size argument, rebound whenever the render resolution changes
+static void engine_bind_resolution(RenderDevice* dev)
+{
+  int width = (int)s_screenResolution[0], height = (int)s_screenResolution[1];
+  int numTiles = (int)s_numTiles;
+
+  clSetKernelArg(dev->clearKernel, 2, sizeof(int), &width);
+  clSetKernelArg(dev->clearKernel, 3, sizeof(int), &height);
+  clSetKernelArg(dev->vertexKernel, 9, sizeof(int), &width);
+  clSetKernelArg(dev->vertexKernel, 10, sizeof(int), &height);
+  clSetKernelArg(dev->setupKernel, 8, sizeof(int), &width);
+  clSetKernelArg(dev->clearTilesKernel, 2, sizeof(int), &numTiles);
+  clSetKernelArg(dev->hizKernel, 3, sizeof(int), &width);
+  clSetKernelArg(dev->hizKernel, 4, sizeof(int), &height);
+  clSetKernelArg(dev->hizReduceKernel, 2, sizeof(int), &width);
+  clSetKernelArg(dev->hizReduceKernel, 3, sizeof(int), &height);
+  clSetKernelArg(dev->binKernel, 4, sizeof(int), &width);
+  clSetKernelArg(dev->lightBoundsKernel, 4, sizeof(int), &width);
+  clSetKernelArg(dev->lightBoundsKernel, 5, sizeof(int), &height);
+  clSetKernelArg(dev->clusterLightsKernel, 4, sizeof(int), &width);
+  clSetKernelArg(dev->clusterLightsKernel, 5, sizeof(int), &height);
+  if (dev->visibilityKernel)
+    clSetKernelArg(dev->visibilityKernel, 4, sizeof(int), &width);
+
+  engine_bind_variant_args(dev);
+}
+
+static void engine_init_render_device(RenderDevice* dev, const char* kernelSource)
+{
+  dev->context = clCreateContext(NULL, 1, &dev->device, NULL, NULL, NULL);
+  dev->queue = clCreateCommandQueue(dev->context, dev->device, CL_QUEUE_PROFILING_ENABLE, NULL);
+  dev->readQueue = clCreateCommandQueue(dev->context, dev->device, CL_QUEUE_PROFILING_ENABLE, NULL);
+  
+  char buildOptions[256];
+  engine_build_options(buildOptions, sizeof(buildOptions), TEXTURE_MODE_ANY, true);
+  dev->program = engine_build_program(dev, kernelSource, buildOptions);
+
+  dev->clearKernel    = clCreateKernel(dev->program, "clear_buffers", NULL);
+  dev->vertexKernel   = clCreateKernel(dev->program, "vertex_kernel", NULL);
+  dev->fragmentKernel = clCreateKernel(dev->program, "fragment_kernel", NULL);
+  dev->variantKernels[engine_fragment_variant(TEXTURE_MODE_ANY, true)] = dev->fragmentKernel;
+  dev->resolveKernels[engine_fragment_variant(TEXTURE_MODE_ANY, true)] = clCreateKernel(dev->program, "resolve_kernel", NULL);
+  dev->clearTilesKernel = clCreateKernel(dev->program, "clear_tiles", NULL);
+  dev->binKernel      = clCreateKernel(dev->program, "bin_kernel", NULL);
+  dev->hizKernel      = clCreateKernel(dev->program, "hiz_kernel", NULL);
+  dev->hizReduceKernel = clCreateKernel(dev->program, "hiz_reduce_kernel", NULL);
+  dev->lightBoundsKernel   = clCreateKernel(dev->program, "light_bounds", NULL);
+  dev->clusterLightsKernel = clCreateKernel(dev->program, "cluster_lights", NULL);
+  dev->setupKernel    = clCreateKernel(dev->program, "setup_kernel", NULL);
+  dev->scanBlocksKernel    = clCreateKernel(dev->program, "scan_blocks", NULL);
+  dev->scanBlockSumsKernel = clCreateKernel(dev->program, "scan_block_sums", NULL);
+  dev->compactKernel  = clCreateKernel(dev->program, "compact_kernel", NULL);
+
+  size_t frameBytes = s_screenResolution[0] * s_screenResolution[1] * sizeof(Color);
+  for (int slot = 0; slot < FRAME_SLOTS; slot++)
+  {
+    dev->frameBuffers[slot] = clCreateBuffer(dev->context, CL_MEM_WRITE_ONLY, frameBytes, NULL, NULL);
+    dev->hostBuffers[slot] = clCreateBuffer(dev->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                            frameBytes, NULL, &s_err);
+    dev->hostPixels[slot] = (Color*)clEnqueueMapBuffer(dev->readQueue, dev->hostBuffers[slot], CL_TRUE,
+                                                       CL_MAP_READ | CL_MAP_WRITE, 0, frameBytes,
+                                                       0, NULL, NULL, &s_err);
+  }
+  dev->depthBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_float) * s_screenResolution[0]
+                                                     * s_screenResolution[1],
+                                                     NULL, &s_err);
+
+  // Only compiled where cl_khr_int64_extended_atomics is (64-bit atom_min), otherwise shading stays in fragment_kernel
+  if (s_visibilityMode)
+  {
+    dev->visibilityKernel = clCreateKernel(dev->program, "visibility_kernel", &s_err);
+    if (s_err != CL_SUCCESS)
+    {
+      printf("No cl_khr_int64_extended_atomics on this device, visibility buffer disabled\n");
+      dev->visibilityKernel = NULL;
+    }
+    else
+    {
+      dev->visibilityBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                             sizeof(cl_ulong) * s_screenResolution[0] * s_screenResolution[1],
+                                             NULL, &s_err);
+      clSetKernelArg(dev->visibilityKernel, 2, sizeof(cl_mem), &dev->visibilityBuffer);
+    }
+  }
+
+  clSetKernelArg(dev->clearKernel, 1, sizeof(cl_mem), &dev->depthBuffer);
+  clSetKernelArg(dev->clearKernel, 4, sizeof(Color), &s_backgroundColor);
+  clSetKernelArg(dev->clearKernel, 5, sizeof(cl_mem), &dev->visibilityBuffer);
+
+  dev->tileCountsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_int) * s_numTiles, NULL, &s_err);
+  dev->tileTrisBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_int) * s_numTiles * TILE_MAX_TRIS, NULL, &s_err);
+  dev->tileDepthBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_int) * s_numTiles, NULL, &s_err);
+  dev->hizGroupsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                      sizeof(cl_int) * 2 * s_numHizGroups, NULL, &s_err);
+
+  clSetKernelArg(dev->clearTilesKernel, 0, sizeof(cl_mem), &dev->tileCountsBuffer);
+  clSetKernelArg(dev->clearTilesKernel, 1, sizeof(cl_mem), &dev->tileDepthBuffer);
+
+  clSetKernelArg(dev->hizKernel, 2, sizeof(cl_mem), &dev->tileDepthBuffer);
+  clSetKernelArg(dev->hizReduceKernel, 0, sizeof(cl_mem), &dev->tileDepthBuffer);
+  clSetKernelArg(dev->hizReduceKernel, 1, sizeof(cl_mem), &dev->hizGroupsBuffer);
+
+  clSetKernelArg(dev->binKernel, 2, sizeof(cl_mem), &dev->tileCountsBuffer);
+  clSetKernelArg(dev->binKernel, 3, sizeof(cl_mem), &dev->tileTrisBuffer);
+  clSetKernelArg(dev->binKernel, 5, sizeof(cl_mem), &dev->tileDepthBuffer);
+  clSetKernelArg(dev->binKernel, 6, sizeof(cl_mem), &dev->hizGroupsBuffer);
+
+  // Light buffers start with room for one light and grow in engine_upload_lights
+  dev->lightsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, sizeof(EngineLight), NULL, &s_err);
+  dev->lightBoundsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, sizeof(cl_float) * 6, NULL, &s_err);
+  dev->clusterCountsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                            sizeof(cl_int) * s_numClusters, NULL, &s_err);
+  dev->clusterLightsBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE,
+                                            sizeof(cl_int) * s_numClusters * CLUSTER_MAX_LIGHTS, NULL, &s_err);
+
+  clSetKernelArg(dev->clusterLightsKernel, 2, sizeof(cl_mem), &dev->clusterCountsBuffer);
+  clSetKernelArg(dev->clusterLightsKernel, 3, sizeof(cl_mem), &dev->clusterLightsBuffer);
+
+  if (dev->visibilityKernel)
+  {
+    clSetKernelArg(dev->visibilityKernel, 3, sizeof(cl_mem), &dev->tileDepthBuffer);
+    clSetKernelArg(dev->visibilityKernel, 5, sizeof(cl_mem), &dev->hizGroupsBuffer);
+  }
+
+  engine_bind_resolution(dev);
+}
+
+static int engine_cpu_count()
+{
+#ifdef _WIN32
+  const char* count = getenv("NUMBER_OF_PROCESSORS");
+  int n = count ? atoi(count) : 0;
+#else
+  int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return n > 0 ? n : 4;
+}
+
+static void engine_init_devices(const char* kernel, int width, int height, cl_device_type deviceType)
+{
+  DeviceEntry picked[MAX_DEVICES];
+  s_deviceCount = s_nativeBackend ? 0 : engine_pick_devices(picked, deviceType);
+
+  s_screenResolution[0] = s_outputResolution[0] = s_pixelResolution[0] = width;
+  s_screenResolution[1] = s_outputResolution[1] = s_pixelResolution[1] = height;
+  s_resolutionScale = 1.0f;
+
+  // Without a device the frame is rasterized on the host threads instead
+  if (s_deviceCount == 0)
+  {
+    if (!s_nativeBackend) printf("No OpenCL device of the requested type, using the native rasterizer.\n");
+    s_nativeBackend = true;
+    s_pixelBuffer = (Color*)malloc(s_screenResolution[0] * s_screenResolution[1] * sizeof(Color));
+    if (!cpu_raster_init(width, height, engine_cpu_count())) printf("Native rasterizer failed to start.\n");
+    return;
+  }
+
+  size_t tilesX = (s_screenResolution[0] + TILE_SIZE - 1) / TILE_SIZE;
+  size_t tilesY = (s_screenResolution[1] + TILE_SIZE - 1) / TILE_SIZE;
+  s_numTiles = tilesX * tilesY;
+  s_numHizGroups = ((tilesX + HIZ_GROUP - 1) / HIZ_GROUP) * ((tilesY + HIZ_GROUP - 1) / HIZ_GROUP);
+  s_numClusters = ((s_screenResolution[0] + CLUSTER_TILE - 1) / CLUSTER_TILE) *
+                  ((s_screenResolution[1] + CLUSTER_TILE - 1) / CLUSTER_TILE) * CLUSTER_SLICES;
+  s_lightCapacity = 0;
+  s_lightsDirty = true; // binds the light buffers on the first frame
+
+  const char* kernelSource = engine_load_kernel(kernel); 
+  s_kernelSource = (char*)kernelSource; // kept for building fragment variants later
+
+  // Initial split is weighted by compute units * clock, then rebalanced from timings
+  float totalWeight = 0.0f;
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    dev->platform = picked[d].platform;
+    dev->device = picked[d].device;
+    printf("Using OpenCL device: %s (%s)\n", picked[d].name, picked[d].platformName);
+
+    cl_uint units = 1, clock = 1;
+    clGetDeviceInfo(dev->device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+    clGetDeviceInfo(dev->device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clock), &clock, NULL);
+    dev->share = (float)(units ? units : 1) * (float)(clock ? clock : 1);
+    totalWeight += dev->share;
+
+    engine_init_render_device(dev, kernelSource);
+  }
+  for (int d = 0; d < s_deviceCount; d++)
+    s_devices[d].share /= totalWeight;
+
+  engine_assign_rows();
+
+  s_pixelBuffer = (Color*)malloc(s_screenResolution[0] * s_screenResolution[1] * sizeof(Color));
+}
+
+void engine_init(const char* kernel,int width, int height)
+{
+  engine_init_devices(kernel, width, height, CL_DEVICE_TYPE_GPU);
+
+  Image img = GenImageColor(s_screenResolution[0], s_screenResolution[1], s_backgroundColor);
+  s_outputTexture = LoadTextureFromImage(img);
+  SetTextureFilter(s_outputTexture, TEXTURE_FILTER_BILINEAR); // upscales frames rendered below window size
+  free(img.data); // pixel buffer is managed by OpenCL
+}
+
+void engine_init_headless(const char* kernel, int width, int height, cl_device_type deviceType)
+{
+  s_headless = true;
+  engine_init_devices(kernel, width, height, deviceType);
+}
+
+static size_t engine_grow_capacity(size_t capacity, size_t needed)
+{
+  if (needed <= capacity) return capacity;
+  return needed > capacity * 2 ? needed : capacity * 2;
+}
+
+// Reallocates buffer for capacity elements, carrying over the first keep.
+// Commands already queued hold their own reference to the old buffer. On
+// failure the old buffer (or NULL) stays and false is returned, the caller
+// must not use more than oldCapacity elements then
+static bool engine_resize_buffer(RenderDevice* dev, cl_mem* buffer, cl_mem_flags flags, size_t elemSize,
+                                 size_t oldCapacity, size_t capacity, size_t keep)
+{
+  if (*buffer && capacity == oldCapacity) return true;
+
+  cl_mem grown = clCreateBuffer(dev->context, flags, (capacity > 0 ? capacity : 1) * elemSize, NULL, &s_err);
+  if (s_err != CL_SUCCESS)
+  {
+    printf("Error growing buffer to %zu bytes: %d\n", (capacity > 0 ? capacity : 1) * elemSize, s_err);
+    return false;
+  }
+  if (*buffer)
+  {
+    if (keep > 0) clEnqueueCopyBuffer(dev->queue, *buffer, grown, 0, 0, keep * elemSize, 0, NULL, NULL);
+    clReleaseMemObject(*buffer);
+  }
+  *buffer = grown;
+  return true;
+}
+
+static void CL_CALLBACK engine_free_staging(cl_event event, cl_int status, void* data)
+{
+  free(data);
+}
+
+// Non-blocking write of streamed-in data from a private copy of src, freed
+// once the transfer completes, so the host arrays stay free to grow
+static bool engine_write_owned(RenderDevice* dev, cl_mem buffer, size_t offset, const void* src, size_t size)
+{
+  if (size == 0) return true;
+
+  void* staging = malloc(size);
+  memcpy(staging, src, size);
+
+  cl_event event = NULL;
+  cl_int err = clEnqueueWriteBuffer(dev->queue, buffer, CL_FALSE, offset, size, staging, 0, NULL, &event);
+  if (err != CL_SUCCESS)
+  {
+    printf("Error writing %zu bytes to device: %d\n", size, err);
+    free(staging);
+    return false;
+  }
+  clSetEventCallback(event, CL_COMPLETE, engine_free_staging, staging);
+  clReleaseEvent(event);
+  return true;
+}
+
+// Called as a frame starts on slot, before its first write lands in the block
+static void engine_reset_staging(RenderDevice* dev, int slot)
+{
+  if (dev->stagingFence[slot])
+  {
+    clWaitForEvents(1, &dev->stagingFence[slot]); // done long ago unless the slot was written out of frame
+    clReleaseEvent(dev->stagingFence[slot]);
+    dev->stagingFence[slot] = NULL;
+  }
+
+  size_t wanted = dev->stagingWanted[slot] > STAGING_MIN_SIZE ? dev->stagingWanted[slot] : STAGING_MIN_SIZE;
+  if (wanted > dev->stagingSize[slot])
+  {
+    free(dev->staging[slot]);
+    dev->staging[slot] = (char*)malloc(wanted);
+    dev->stagingSize[slot] = wanted;
+  }
+  dev->stagingUsed[slot] = 0;
+  dev->stagingWanted[slot] = 0;
+}
+
+// Non-blocking write of per-frame data through the current slot's staging
+// block, or a blocking one when the block is full until its next reset
+static bool engine_write_range(RenderDevice* dev, cl_mem buffer, size_t offset, const void* src, size_t size)
+{
+  if (size == 0) return true;
+
+  int slot = s_frameIndex % FRAME_SLOTS;
+  size_t aligned = (size + 15) & ~(size_t)15;
+  size_t start = dev->stagingUsed[slot];
+  dev->stagingWanted[slot] += aligned;
+
+  cl_int err;
+  if (start + aligned > dev->stagingSize[slot])
+  {
+    err = clEnqueueWriteBuffer(dev->queue, buffer, CL_TRUE, offset, size, src, 0, NULL, NULL);
+  }
+  else
+  {
+    memcpy(dev->staging[slot] + start, src, size);
+    dev->stagingUsed[slot] = start + aligned;
+
+    cl_event event = NULL;
+    err = clEnqueueWriteBuffer(dev->queue, buffer, CL_FALSE, offset, size, dev->staging[slot] + start, 0, NULL, &event);
+    if (err == CL_SUCCESS)
+    {
+      if (dev->stagingFence[slot]) clReleaseEvent(dev->stagingFence[slot]);
+      dev->stagingFence[slot] = event;
+    }
+  }
+  if (err != CL_SUCCESS) printf("Error writing %zu bytes to device: %d\n", size, err);
+  return err == CL_SUCCESS;
+}
+
+// Resends the whole light list when it changed, lights are few next to geometry
+static void engine_upload_lights()
+{
+  size_t numLights = arrlen(s_lights);
+  size_t capacity = engine_grow_capacity(s_lightCapacity > 0 ? s_lightCapacity : 1, numLights);
+
+  // Both buffers are rewritten from scratch, so a device that could not grow
+  // them just draws without lights until the retry on the next frame succeeds
+  bool resized = true;
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    bool fits = true;
+    if (capacity != s_lightCapacity)
+    {
+      fits = engine_resize_buffer(dev, &dev->lightsBuffer, CL_MEM_READ_ONLY, sizeof(EngineLight),
+                                  s_lightCapacity, capacity, 0) && fits;
+      fits = engine_resize_buffer(dev, &dev->lightBoundsBuffer, CL_MEM_READ_WRITE, sizeof(cl_float) * 6,
+                                  s_lightCapacity, capacity, 0) && fits;
+      engine_bind_variant_args(dev);
+    }
+    if (fits) engine_write_range(dev, dev->lightsBuffer, 0, s_lights, numLights * sizeof(EngineLight));
+    resized = resized && fits;
+
+    int count = fits ? (int)numLights : 0;
+    clSetKernelArg(dev->lightBoundsKernel, 0, sizeof(cl_mem), &dev->lightsBuffer);
+    clSetKernelArg(dev->lightBoundsKernel, 1, sizeof(int), &count);
+    clSetKernelArg(dev->lightBoundsKernel, 6, sizeof(cl_mem), &dev->lightBoundsBuffer);
+    clSetKernelArg(dev->clusterLightsKernel, 0, sizeof(cl_mem), &dev->lightBoundsBuffer);
+    clSetKernelArg(dev->clusterLightsKernel, 1, sizeof(int), &count);
+  }
+
+  if (!resized) return; // s_lightsDirty stays set
+  s_lightCapacity = capacity;
+  s_lightsDirty = false;
+}
+
+static float engine_axis(f3 v, int axis)
+{
+  return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static int engine_bvh_axis;
+
+static int engine_compare_centers(const void* a, const void* b)
+{
+  float ca = engine_axis(s_modelBounds[*(const int*)a].center, engine_bvh_axis);
+  float cb = engine_axis(s_modelBounds[*(const int*)b].center, engine_bvh_axis);
+  return (ca > cb) - (ca < cb);
+}
+
+// Median split on the widest axis of the instance centers
+static int engine_build_bvh_node(int first, int count)
+{
+  BvhNode node = { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX }, first, count, -1, -1 };
+  f3 cmin = node.min, cmax = node.max;
+
+  for (int i = first; i < first + count; i++)
+  {
+    const ModelBounds* b = &s_modelBounds[s_bvhOrder[i]];
+    node.min = (f3){ fminf(node.min.x, b->min.x), fminf(node.min.y, b->min.y), fminf(node.min.z, b->min.z) };
+    node.max = (f3){ fmaxf(node.max.x, b->max.x), fmaxf(node.max.y, b->max.y), fmaxf(node.max.z, b->max.z) };
+    cmin = (f3){ fminf(cmin.x, b->center.x), fminf(cmin.y, b->center.y), fminf(cmin.z, b->center.z) };
+    cmax = (f3){ fmaxf(cmax.x, b->center.x), fmaxf(cmax.y, b->center.y), fmaxf(cmax.z, b->center.z) };
+  }
+
+  int index = (int)arrlen(s_bvhNodes);
+  arrpush(s_bvhNodes, node);
+  if (count <= BVH_LEAF_SIZE) return index;
+
+  f3 extent = { cmax.x - cmin.x, cmax.y - cmin.y, cmax.z - cmin.z };
+  engine_bvh_axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+  qsort(&s_bvhOrder[first], count, sizeof(int), engine_compare_centers);
+
+  int half = count / 2;
+  int left = engine_build_bvh_node(first, half);
+  int right = engine_build_bvh_node(first + half, count - half);
+  s_bvhNodes[index].left = left; // s_bvhNodes may have moved
+  s_bvhNodes[index].right = right;
+  return index;
+}
+
+static void engine_build_bvh()
+{
+  int numModels = (int)arrlen(s_Models);
+  s_bvhModels = numModels;
+  s_bvhDirty = false;
+
+  arrfree(s_bvhNodes);
+  arrsetlen(s_bvhOrder, numModels);
+  arrsetlen(s_modelVisible, numModels);
+  for (int i = 0; i < numModels; i++) s_bvhOrder[i] = i;
+
+  if (numModels > 0) engine_build_bvh_node(0, numModels);
+}
+
+// Recomputes node bounds bottom-up for moved instances, the tree shape stays.
+// Children always come after their parent in s_bvhNodes
+static void engine_refit_bvh()
+{
+  for (int n = (int)arrlen(s_bvhNodes) - 1; n >= 0; n--)
+  {
+    BvhNode* node = &s_bvhNodes[n];
+    if (node->left >= 0)
+    {
+      const BvhNode* l = &s_bvhNodes[node->left];
+      const BvhNode* r = &s_bvhNodes[node->right];
+      node->min = (f3){ fminf(l->min.x, r->min.x), fminf(l->min.y, r->min.y), fminf(l->min.z, r->min.z) };
+      node->max = (f3){ fmaxf(l->max.x, r->max.x), fmaxf(l->max.y, r->max.y), fmaxf(l->max.z, r->max.z) };
+      continue;
+    }
+
+    node->min = (f3){ FLT_MAX, FLT_MAX, FLT_MAX };
+    node->max = (f3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = node->first; i < node->first + node->count; i++)
+    {
+      const ModelBounds* b = &s_modelBounds[s_bvhOrder[i]];
+      node->min = (f3){ fminf(node->min.x, b->min.x), fminf(node->min.y, b->min.y), fminf(node->min.z, b->min.z) };
+      node->max = (f3){ fmaxf(node->max.x, b->max.x), fmaxf(node->max.y, b->max.y), fmaxf(node->max.z, b->max.z) };
+    }
+  }
+  s_bvhDirty = false;
+}
+
+typedef struct { float a, b, c, d; } Plane;
+
+// Planes of the region the rasterizer keeps: in front of the camera (w < 0
+// with this projection) and inside the screen edges. No far plane, the
+// pipeline does not clip against it either
+static void engine_frustum_planes(Plane planes[5])
+{
+  f4x4 m = MatMul(s_camera.proj, s_frameView.view);
+  const float* r0 = m.f[0];
+  const float* r1 = m.f[1];
+  const float* r3 = m.f[3];
+
+  planes[0] = (Plane){ r0[0] - r3[0], r0[1] - r3[1], r0[2] - r3[2], r0[3] - r3[3] };
+  planes[1] = (Plane){ -r0[0] - r3[0], -r0[1] - r3[1], -r0[2] - r3[2], -r0[3] - r3[3] };
+  planes[2] = (Plane){ r1[0] - r3[0], r1[1] - r3[1], r1[2] - r3[2], r1[3] - r3[3] };
+  planes[3] = (Plane){ -r1[0] - r3[0], -r1[1] - r3[1], -r1[2] - r3[2], -r1[3] - r3[3] };
+  planes[4] = (Plane){ -r3[0], -r3[1], -r3[2], -r3[3] };
+
+  for (int p = 0; p < 5; p++)
+  {
+    float len = sqrtf(planes[p].a * planes[p].a + planes[p].b * planes[p].b + planes[p].c * planes[p].c);
+    if (len > 0.0f)
+    {
+      planes[p].a /= len; planes[p].b /= len; planes[p].c /= len; planes[p].d /= len;
+    }
+  }
+}
+
+// -1 outside, 0 intersecting, 1 fully inside
+static int engine_classify_box(const Plane planes[5], f3 min, f3 max)
+{
+  int result = 1;
+  for (int p = 0; p < 5; p++)
+  {
+    const Plane* pl = &planes[p];
+    f3 positive = { pl->a >= 0 ? max.x : min.x, pl->b >= 0 ? max.y : min.y, pl->c >= 0 ? max.z : min.z };
+    f3 negative = { pl->a >= 0 ? min.x : max.x, pl->b >= 0 ? min.y : max.y, pl->c >= 0 ? min.z : max.z };
+
+    if (pl->a * positive.x + pl->b * positive.y + pl->c * positive.z + pl->d < 0.0f) return -1;
+    if (pl->a * negative.x + pl->b * negative.y + pl->c * negative.z + pl->d < 0.0f) result = 0;
+  }
+  return result;
+}
+
+static bool engine_sphere_outside(const Plane planes[5], f3 center, float radius)
+{
+  for (int p = 0; p < 5; p++)
+    if (planes[p].a * center.x + planes[p].b * center.y + planes[p].c * center.z + planes[p].d < -radius)
+      return true;
+  return false;
+}
+
+static void engine_cull_node(const Plane planes[5], int index)
+{
+  const BvhNode* node = &s_bvhNodes[index];
+  int side = engine_classify_box(planes, node->min, node->max);
+  if (side < 0) return;
+
+  if (side > 0 || node->left < 0)
+  {
+    for (int i = node->first; i < node->first + node->count; i++)
+    {
+      int model = s_bvhOrder[i];
+      if (side > 0) { s_modelVisible[model] = 1; continue; }
+
+      const ModelBounds* b = &s_modelBounds[model];
+      if (!engine_sphere_outside(planes, b->center, b->radius) && engine_classify_box(planes, b->min, b->max) >= 0)
+        s_modelVisible[model] = 1;
+    }
+    return;
+  }
+
+  engine_cull_node(planes, node->left);
+  engine_cull_node(planes, node->right);
+}
+
+// Walks the BVH against the camera frustum and packs the surviving instances
+// back to back, the kernels then only see their vertices and triangles
+static void engine_cull_models()
+{
+  int numModels = (int)arrlen(s_Models);
+  memset(s_modelVisible, 0, numModels);
+
+  if (s_bvhDirty) engine_refit_bvh();
+
+  if (numModels > 0)
+  {
+    Plane planes[5];
+    engine_frustum_planes(planes);
+    engine_cull_node(planes, 0);
+  }
+
+  arrsetlen(s_drawRanges, numModels);
+  int numVisible = 0;
+  s_frameVerts = 0;
+  s_frameTriangles = 0;
+  for (int i = 0; i < numModels; i++)
+  {
+    if (!s_modelVisible[i]) continue;
+
+    DrawRange* range = &s_drawRanges[numVisible++];
+    range->model = i;
+    range->vertexOffset = (int)s_frameVerts;
+    range->triangleOffset = (int)s_frameTriangles;
+    s_frameVerts += s_Models[i].vertexCount;
+    s_frameTriangles += s_Models[i].triangleCount;
+  }
+  arrsetlen(s_drawRanges, numVisible);
+
+  // Kernels bounds-check against the counts, a launch is never empty
+  s_paddedTriangles = (s_frameTriangles + SCAN_BLOCK - 1) / SCAN_BLOCK * SCAN_BLOCK;
+  if (s_paddedTriangles == 0) s_paddedTriangles = SCAN_BLOCK;
+}
+
+// Per-frame draw ranges and counts for the vertex and setup passes of one device
+static void engine_bind_visible_models(RenderDevice* dev)
+{
+  int numRanges = (int)arrlen(s_drawRanges);
+  int totalVerts = (int)s_frameVerts;
+  int totalTriangles = (int)s_frameTriangles;
+  int numScanBlocks = (int)(s_paddedTriangles / SCAN_BLOCK);
+
+  engine_write_range(dev, dev->drawRangesBuffer, 0, s_drawRanges, numRanges * sizeof(DrawRange));
+
+  clSetKernelArg(dev->vertexKernel, 3, sizeof(int), &numRanges);
+  clSetKernelArg(dev->vertexKernel, 4, sizeof(int), &totalVerts);
+  clSetKernelArg(dev->setupKernel, 4, sizeof(int), &numRanges);
+  clSetKernelArg(dev->setupKernel, 5, sizeof(int), &totalTriangles);
+  clSetKernelArg(dev->scanBlocksKernel, 3, sizeof(int), &totalTriangles);
+  clSetKernelArg(dev->scanBlockSumsKernel, 1, sizeof(int), &numScanBlocks);
+  clSetKernelArg(dev->compactKernel, 5, sizeof(int), &totalTriangles);
+}
+
+void engine_background_color(Color color)
+{
+  engine_scene_lock();
+  s_backgroundColor = color;
+  for (int d = 0; d < s_deviceCount; d++)
+    clSetKernelArg(s_devices[d].clearKernel, 4, sizeof(Color), &color);
+  engine_scene_unlock();
+}
+
+// Switches to the pending render resolution between frames, every buffer keeps
+// its output-size allocation so only the size arguments and bands change
+static void engine_apply_resolution()
+{
+  if (s_pendingResolution[0] == 0) return;
+
+  bool changed = s_pendingResolution[0] != s_screenResolution[0] || s_pendingResolution[1] != s_screenResolution[1];
+  s_screenResolution[0] = s_pendingResolution[0];
+  s_screenResolution[1] = s_pendingResolution[1];
+  s_pendingResolution[0] = s_pendingResolution[1] = 0;
+  if (!changed || s_nativeBackend) return;
+
+  size_t tilesX = (s_screenResolution[0] + TILE_SIZE - 1) / TILE_SIZE;
+  size_t tilesY = (s_screenResolution[1] + TILE_SIZE - 1) / TILE_SIZE;
+  s_numTiles = tilesX * tilesY;
+  s_numHizGroups = ((tilesX + HIZ_GROUP - 1) / HIZ_GROUP) * ((tilesY + HIZ_GROUP - 1) / HIZ_GROUP);
+  s_numClusters = ((s_screenResolution[0] + CLUSTER_TILE - 1) / CLUSTER_TILE) *
+                  ((s_screenResolution[1] + CLUSTER_TILE - 1) / CLUSTER_TILE) * CLUSTER_SLICES;
+  for (int d = 0; d < s_deviceCount; d++)
+    engine_bind_resolution(&s_devices[d]);
+  engine_assign_rows();
+}
+
+void engine_clear_background()
+{
+  int slot = s_frameIndex % FRAME_SLOTS;
+  engine_apply_resolution();
+  s_slotResolution[slot][0] = s_screenResolution[0];
+  s_slotResolution[slot][1] = s_screenResolution[1];
+
+  if (s_nativeBackend) return; // every pixel is written by cpu_raster_render
+
+  double hostStart = engine_now_ms();
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    engine_reset_staging(dev, slot);
+    dev->slotRowStart[slot] = dev->rowStart;
+    dev->slotRowEnd[slot] = dev->rowEnd;
+    if (dev->rowEnd <= dev->rowStart) continue;
+
+    engine_use_fragment_variant(dev);
+    clSetKernelArg(dev->clearKernel, 0, sizeof(cl_mem), &dev->frameBuffers[slot]);
+    clSetKernelArg(dev->fragmentKernel, 0, sizeof(cl_mem), &dev->frameBuffers[slot]);
+
+    // The slot may still be in flight on the read queue from two frames ago,
+    // its events are only dropped once the clear is queued behind them
+    cl_event event = NULL;
+    size_t offset[2] = { 0, (size_t)dev->rowStart };
+    size_t size[2] = { s_screenResolution[0], (size_t)(dev->rowEnd - dev->rowStart) };
+    clEnqueueNDRangeKernel(dev->queue, dev->clearKernel, 2, offset, size, NULL,
+                           dev->readEvents[slot] ? 1 : 0,
+                           dev->readEvents[slot] ? &dev->readEvents[slot] : NULL, &event);
+
+    engine_reset_stage_events(dev, slot);
+    cl_event* clearEvent = engine_stage_event(dev, slot, STAGE_CLEAR);
+    if (clearEvent) *clearEvent = event;
+    else clReleaseEvent(event);
+  }
+
+  s_hostMs += engine_now_ms() - hostStart;
+}
+
+static void engine_write_camera()
+{
+  double hostStart = engine_now_ms();
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    engine_write_range(dev, dev->cameraPosBuffer, 0, &s_frameView.position, sizeof(f3));
+    engine_write_range(dev, dev->viewBuffer, 0, &s_frameView.view, sizeof(f4x4));
+  }
+
+  s_hostMs += engine_now_ms() - hostStart;
+}
+
+void engine_send_camera_matrix()
+{
+  s_frameView = (FrameView){ s_camera.Position, s_camera.look_at };
+  engine_write_camera();
+}
+
+// Hands the culled instances to cpu_raster.c, the frame lands in s_pixelBuffer
+static void engine_run_native()
+{
+  int numVisible = (int)arrlen(s_drawRanges);
+  CpuInstance* instances = (CpuInstance*)malloc((numVisible > 0 ? numVisible : 1) * sizeof(CpuInstance));
+  for (int i = 0; i < numVisible; i++)
+  {
+    const CustomModel* model = &s_Models[s_drawRanges[i].model];
+    instances[i] = (CpuInstance){ model->meshTriangleOffset, model->triangleCount,
+                                  model->meshVertexOffset, model->vertexCount,
+                                  model->pixelOffset, model->texWidth, model->texHeight, model->transform };
+  }
+
+  CpuScene scene = {
+    .triangles = s_allTriangles,
+    .vertices = s_allVertices,
+    .texels = s_allTexturePixels,
+    .instances = instances,
+    .numInstances = numVisible,
+    .view = s_frameView.view,
+    .projection = s_camera.proj,
+    .lighting = s_lighting,
+    .background = s_backgroundColor,
+    .width = (int)s_screenResolution[0],
+    .height = (int)s_screenResolution[1]
+  };
+  memset(s_nativeStageMs, 0, sizeof(s_nativeStageMs));
+  if (s_pipelineRunning) mtx_lock(&s_presentMutex);
+  cpu_raster_render(&scene, s_pixelBuffer, s_nativeStageMs);
+  s_pixelResolution[0] = s_screenResolution[0];
+  s_pixelResolution[1] = s_screenResolution[1];
+  s_framesFinished++;
+  if (s_pipelineRunning) mtx_unlock(&s_presentMutex);
+  free(instances);
+}
+
+// Switches every instance to the coarsest level whose triangles still cover at
+// most LOD_TRIANGLE_PIXELS of its projected bounding sphere. Only counts and
+// offsets change, switched instances go up with the next model upload
+static void engine_select_lods()
+{
+  if (!s_meshLods) return;
+
+  // Pixels per unit of size over distance, same focal term the projection uses
+  float focal = s_camera.proj.f[1][1] * 0.5f * (float)s_screenResolution[1];
+  int numModels = (int)arrlen(s_Models);
+  for (int i = 0; i < numModels; i++)
+  {
+    const CustomMesh* mesh = &s_meshes[s_modelMeshes[i]];
+    if (mesh->lodCount <= 1) continue;
+
+    const ModelBounds* b = &s_modelBounds[i];
+    float distance = f3Len(f3Sub(b->center, s_frameView.position));
+    int level = 0;
+    if (distance > b->radius)
+    {
+      float diameter = 2.0f * b->radius / distance * focal;
+      float area = diameter * diameter;
+      level = mesh->lodCount - 1;
+      while (level > 0 && mesh->lods[level].triangleCount * LOD_TRIANGLE_PIXELS < area) level--;
+      if (level > s_modelLods[i] && mesh->lods[level].triangleCount * LOD_TRIANGLE_PIXELS < area * LOD_HYSTERESIS)
+        level--;
+    }
+    if (level == s_modelLods[i]) continue;
+
+    const MeshLod* lod = &mesh->lods[level];
+    s_Models[i].meshTriangleOffset = lod->triangleOffset;
+    s_Models[i].triangleCount = lod->triangleCount;
+    s_Models[i].meshVertexOffset = lod->vertexOffset;
+    s_Models[i].vertexCount = lod->vertexCount;
+    s_modelLods[i] = level;
+
+    if (i < s_dirtyFirst) s_dirtyFirst = i;
+    if (i > s_dirtyLast) s_dirtyLast = i;
+  }
+}
+
+void engine_run_rasterizer()
+{
+  double hostStart = engine_now_ms();
+  int slot = s_frameIndex % FRAME_SLOTS;
+
+  engine_select_lods();
+
+  // Streamed-in models and moved instances reach the devices before culling
+  // Until a failed upload goes through the devices draw nothing, their
+  // buffers may be smaller than the counts the kernels would use
+  bool uploaded = true;
+  if (arrlen(s_allTriangles) != s_uploadedTriangles || arrlen(s_allTexturePixels) != s_uploadedPixels ||
+      arrlen(s_Models) != s_uploadedModels || s_dirtyLast >= 0)
+    uploaded = engine_upload_models_data();
+
+  if (s_lightsDirty) engine_upload_lights();
+
+  engine_cull_models();
+
+  if (s_nativeBackend)
+  {
+    s_hostMs += engine_now_ms() - hostStart; // render time goes to the stage timings
+    engine_run_native();
+    return;
+  }
+
+  if (!uploaded)
+  {
+    for (int d = 0; d < s_deviceCount; d++) clFinish(s_devices[d].queue); // the slot's clear, before readback
+    s_hostMs += engine_now_ms() - hostStart;
+    return;
+  }
+
+  size_t vertexCount = s_frameVerts > 0 ? s_frameVerts : 1;
+  size_t lightCount = arrlen(s_lights) > 0 ? arrlen(s_lights) : 1;
+
+  // Every device transforms and sets up the whole visible scene but only bins
+  // and shades the triangles touching its own band of rows
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    if (dev->rowEnd <= dev->rowStart) continue;
+
+    engine_bind_visible_models(dev);
+
+    clEnqueueNDRangeKernel(dev->queue, dev->clearTilesKernel, 1, NULL,
+                           &s_numTiles, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+    clEnqueueNDRangeKernel(dev->queue, dev->vertexKernel, 1, NULL,
+                           &vertexCount, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_VERTEX));
+
+    // Lights go to screen-space bounds, then to the clusters those overlap
+    clEnqueueNDRangeKernel(dev->queue, dev->lightBoundsKernel, 1, NULL,
+                           &lightCount, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+    clEnqueueNDRangeKernel(dev->queue, dev->clusterLightsKernel, 1, NULL,
+                           &s_numClusters, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+
+    size_t scanLocal = SCAN_BLOCK;
+    clEnqueueNDRangeKernel(dev->queue, dev->setupKernel, 1, NULL,
+                           &s_paddedTriangles, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_SETUP));
+    clEnqueueNDRangeKernel(dev->queue, dev->scanBlocksKernel, 1, NULL,
+                           &s_paddedTriangles, &scanLocal, 0, NULL, engine_stage_event(dev, slot, STAGE_SETUP));
+    clEnqueueNDRangeKernel(dev->queue, dev->scanBlockSumsKernel, 1, NULL,
+                           &scanLocal, &scanLocal, 0, NULL, engine_stage_event(dev, slot, STAGE_SETUP));
+    clEnqueueNDRangeKernel(dev->queue, dev->compactKernel, 1, NULL,
+                           &s_paddedTriangles, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_SETUP));
+
+    // Dispatched over every triangle, work-items past the visible count exit early.
+    // Occluders are gathered first so binning can drop what they hide, the
+    // per-tile bounds are then reduced to the coarse level binning tests first
+    clEnqueueNDRangeKernel(dev->queue, dev->hizKernel, 1, NULL,
+                           &s_paddedTriangles, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+    clEnqueueNDRangeKernel(dev->queue, dev->hizReduceKernel, 1, NULL,
+                           &s_numHizGroups, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+
+    // Visibility mode rasterizes triangle-parallel into the visibility buffer
+    // and shades every pixel once in the resolve pass, no tile lists needed
+    if (dev->visibilityBuffer)
+    {
+      size_t visibilitySize[2] = { s_paddedTriangles, VISIBILITY_LANES };
+      clEnqueueNDRangeKernel(dev->queue, dev->visibilityKernel, 2, NULL,
+                             visibilitySize, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_FRAGMENT));
+    }
+    else
+    {
+      clEnqueueNDRangeKernel(dev->queue, dev->binKernel, 1, NULL,
+                             &s_paddedTriangles, NULL, 0, NULL, engine_stage_event(dev, slot, STAGE_BINNING));
+    }
+
+    cl_event* event = engine_stage_event(dev, slot, STAGE_FRAGMENT);
+    size_t offset[2] = { 0, (size_t)dev->rowStart };
+    size_t size[2] = { s_screenResolution[0], (size_t)(dev->rowEnd - dev->rowStart) };
+    clEnqueueNDRangeKernel(dev->queue, dev->fragmentKernel, 2, offset, size, NULL, 0, NULL, event);
+    dev->fragmentEvents[slot] = event ? *event : NULL;
+    clFlush(dev->queue);
+  }
+
+  s_hostMs += engine_now_ms() - hostStart;
+}
+
+// Queues the copy of a slot's bands into pinned host memory behind that
+// frame's fragment pass, without blocking the host
+static void engine_enqueue_readback(int slot)
+{
+  size_t width = s_slotResolution[slot][0];
+  size_t rowBytes = width * sizeof(Color);
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    int rowStart = dev->slotRowStart[slot];
+    int rowEnd = dev->slotRowEnd[slot];
+    if (rowEnd <= rowStart) continue;
+
+    cl_event* event = engine_stage_event(dev, slot, STAGE_READBACK);
+    clEnqueueReadBuffer(dev->readQueue, dev->frameBuffers[slot], CL_FALSE, rowStart * rowBytes,
+                        (rowEnd - rowStart) * rowBytes,
+                        dev->hostPixels[slot] + rowStart * width,
+                        dev->fragmentEvents[slot] ? 1 : 0,
+                        dev->fragmentEvents[slot] ? &dev->fragmentEvents[slot] : NULL, event);
+    dev->readEvents[slot] = event ? *event : NULL;
+    clFlush(dev->readQueue);
+  }
+}
+
+static void engine_wait_readback(int slot)
+{
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    if (dev->slotRowEnd[slot] > dev->slotRowStart[slot] && dev->readEvents[slot])
+      clWaitForEvents(1, &dev->readEvents[slot]);
+  }
+}
+
+// Copies the bands of a read back slot into s_pixelBuffer
+static void engine_copy_frame(int slot)
+{
+  if (s_pipelineRunning) mtx_lock(&s_presentMutex);
+
+  size_t width = s_slotResolution[slot][0];
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    int rowStart = dev->slotRowStart[slot];
+    int rowEnd = dev->slotRowEnd[slot];
+    if (rowEnd <= rowStart) continue;
+
+    size_t offset = rowStart * width;
+    memcpy(s_pixelBuffer + offset, dev->hostPixels[slot] + offset,
+           (rowEnd - rowStart) * width * sizeof(Color));
+  }
+  s_pixelResolution[0] = width;
+  s_pixelResolution[1] = s_slotResolution[slot][1];
+  s_framesFinished++;
+
+  if (s_pipelineRunning) mtx_unlock(&s_presentMutex);
+}
+
+void engine_read_frame()
+{
+  double hostStart = engine_now_ms();
+  int slot = s_frameIndex % FRAME_SLOTS;
+
+  if (s_nativeBackend)
+  {
+    engine_collect_stats(slot);
+    s_frameIndex++;
+    return;
+  }
+
+  engine_enqueue_readback(slot);
+  engine_wait_readback(slot);
+  engine_copy_frame(slot);
+
+  s_hostMs += engine_now_ms() - hostStart;
+  engine_collect_stats(slot);
+  engine_balance_devices(slot);
+  s_frameIndex++;
+}
+
+// Stretches the rendered width x height corner of the output texture over the
+// window, bilinear filtering does the upscale
+static void engine_draw_output(size_t width, size_t height)
+{
+  Rectangle source = { 0.0f, 0.0f, (float)width, (float)height };
+  Rectangle dest = { 0.0f, 0.0f, (float)s_outputResolution[0], (float)s_outputResolution[1] };
+
+  BeginDrawing();
+  DrawTexturePro(s_outputTexture, source, dest, (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
+  EndDrawing();
+}
+
+// Presents the previous frame straight from pinned memory while the one
+// just submitted is still rendering, at the cost of one frame of latency
+void engine_read_and_display()
+{
+  if (s_headless) { engine_read_frame(); return; }
+
+  if (s_nativeBackend)
+  {
+    Rectangle frame = { 0.0f, 0.0f, (float)s_pixelResolution[0], (float)s_pixelResolution[1] };
+    UpdateTextureRec(s_outputTexture, frame, s_pixelBuffer);
+    engine_draw_output(s_pixelResolution[0], s_pixelResolution[1]);
+    engine_collect_stats(s_frameIndex % FRAME_SLOTS);
+    s_frameIndex++;
+    return;
+  }
+
+  double hostStart = engine_now_ms();
+  int slot = s_frameIndex % FRAME_SLOTS;
+  engine_enqueue_readback(slot);
+
+  if (s_frameIndex > 0)
+  {
+    int shown = (s_frameIndex - 1) % FRAME_SLOTS;
+    size_t width = s_slotResolution[shown][0];
+    engine_wait_readback(shown);
+
+    for (int d = 0; d < s_deviceCount; d++)
+    {
+      RenderDevice* dev = &s_devices[d];
+      int rowStart = dev->slotRowStart[shown];
+      int rowEnd = dev->slotRowEnd[shown];
+      if (rowEnd <= rowStart) continue;
+
+      Rectangle band = { 0.0f, (float)rowStart, (float)width, (float)(rowEnd - rowStart) };
+      UpdateTextureRec(s_outputTexture, band, dev->hostPixels[shown] + rowStart * width);
+    }
+
+    engine_draw_output(width, s_slotResolution[shown][1]);
+
+    s_hostMs += engine_now_ms() - hostStart;
+    engine_collect_stats(shown);
+    engine_balance_devices(shown);
+  }
+
+  s_frameIndex++;
+}
+
+// Queues this frame's readback and lands the previous one, so the devices
+// already work on the new frame while the submit thread waits
+static void engine_retire_frame()
+{
+  int slot = s_frameIndex % FRAME_SLOTS;
+
+  if (s_nativeBackend)
+  {
+    engine_collect_stats(slot);
+    s_frameIndex++;
+    return;
+  }
+
+  engine_enqueue_readback(slot);
+  if (s_frameIndex > 0)
+  {
+    int previous = (s_frameIndex - 1) % FRAME_SLOTS;
+    double hostStart = engine_now_ms();
+    engine_wait_readback(previous);
+    engine_copy_frame(previous);
+    s_hostMs += engine_now_ms() - hostStart;
+    engine_collect_stats(previous);
+    engine_balance_devices(previous);
+  }
+  s_frameIndex++;
+}
+
+static int engine_pipeline_worker(void* arg)
+{
+  (void)arg;
+
+  for (;;)
+  {
+    mtx_lock(&s_queueMutex);
+    while (s_queueCount == 0 && !s_pipelineStop)
+      cnd_wait(&s_queueChanged, &s_queueMutex);
+    if (s_queueCount == 0) { mtx_unlock(&s_queueMutex); return 0; }
+    FrameView view = s_frameQueue[s_queueHead];
+    mtx_unlock(&s_queueMutex);
+
+    // Only the host-side submission reads the scene, the device wait below does not
+    mtx_lock(&s_sceneMutex);
+    s_frameView = view;
+    engine_clear_background();
+    engine_write_camera();
+    engine_run_rasterizer();
+    mtx_unlock(&s_sceneMutex);
+
+    mtx_lock(&s_queueMutex);
+    s_queueHead = (s_queueHead + 1) % PIPELINE_MAX_DEPTH;
+    s_queueCount--;
+    cnd_broadcast(&s_queueChanged);
+    mtx_unlock(&s_queueMutex);
+
+    engine_retire_frame();
+  }
+}
+
+void engine_pipeline_start(int depth)
+{
+  if (s_pipelineRunning) return;
+
+  s_pipelineDepth = depth < 1 ? 1 : depth > PIPELINE_MAX_DEPTH ? PIPELINE_MAX_DEPTH : depth;
+  s_pipelineStop = false;
+  s_queueHead = 0;
+  s_queueCount = 0;
+  s_framesFinished = s_framesPresented = 0;
+
+  if (mtx_init(&s_sceneMutex, mtx_plain | mtx_recursive) != thrd_success ||
+      mtx_init(&s_presentMutex, mtx_plain) != thrd_success ||
+      mtx_init(&s_queueMutex, mtx_plain) != thrd_success ||
+      cnd_init(&s_queueChanged) != thrd_success)
+  {
+    printf("Cannot create the frame pipeline, rendering stays serial.\n");
+    return;
+  }
+
+  s_pipelineRunning = true;
+  if (thrd_create(&s_pipelineThread, engine_pipeline_worker, NULL) != thrd_success)
+  {
+    printf("Cannot start the submit thread, rendering stays serial.\n");
+    s_pipelineRunning = false;
+  }
+}
+
+void engine_pipeline_submit()
+{
+  if (!s_pipelineRunning) return;
+
+  mtx_lock(&s_queueMutex);
+  while (s_queueCount >= s_pipelineDepth)
+    cnd_wait(&s_queueChanged, &s_queueMutex);
+  s_frameQueue[(s_queueHead + s_queueCount) % PIPELINE_MAX_DEPTH] = (FrameView){ s_camera.Position, s_camera.look_at };
+  s_queueCount++;
+  cnd_broadcast(&s_queueChanged);
+  mtx_unlock(&s_queueMutex);
+}
+
+bool engine_pipeline_present()
+{
+  static size_t shown[2] = { 0, 0 };
+  bool fresh = false;
+
+  // A frame still being copied in shows next time, presenting never waits on the submit thread
+  if (s_pipelineRunning && mtx_trylock(&s_presentMutex) == thrd_success)
+  {
+    if (s_framesPresented != s_framesFinished)
+    {
+      Rectangle frame = { 0.0f, 0.0f, (float)s_pixelResolution[0], (float)s_pixelResolution[1] };
+      UpdateTextureRec(s_outputTexture, frame, s_pixelBuffer);
+      shown[0] = s_pixelResolution[0];
+      shown[1] = s_pixelResolution[1];
+      s_framesPresented = s_framesFinished;
+      fresh = true;
+    }
+    mtx_unlock(&s_presentMutex);
+  }
+
+  engine_draw_output(shown[0], shown[1]);
+  return fresh;
+}
+
+void engine_pipeline_stop()
+{
+  if (!s_pipelineRunning) return;
+
+  mtx_lock(&s_queueMutex);
+  s_pipelineStop = true;
+  cnd_broadcast(&s_queueChanged);
+  mtx_unlock(&s_queueMutex);
+  thrd_join(s_pipelineThread, NULL);
+
+  // The last frame's readback is still outstanding
+  if (!s_nativeBackend && s_frameIndex > 0)
+  {
+    int last = (s_frameIndex - 1) % FRAME_SLOTS;
+    engine_wait_readback(last);
+    engine_copy_frame(last);
+    engine_collect_stats(last);
+  }
+
+  s_pipelineRunning = false;
+  mtx_destroy(&s_sceneMutex);
+  mtx_destroy(&s_presentMutex);
+  mtx_destroy(&s_queueMutex);
+  cnd_destroy(&s_queueChanged);
+}
+
+// Bilinear resample of a packed width x height image to the output size
+static void engine_upscale(const Color* src, size_t width, size_t height, Color* dst)
+{
+  float sx = (float)width / s_outputResolution[0], sy = (float)height / s_outputResolution[1];
+  for (size_t y = 0; y < s_outputResolution[1]; y++)
+  {
+    float fy = fmaxf((y + 0.5f) * sy - 0.5f, 0.0f);
+    size_t y0 = (size_t)fy, y1 = y0 + 1 < height ? y0 + 1 : y0;
+    float ty = fy - y0;
+
+    for (size_t x = 0; x < s_outputResolution[0]; x++)
+    {
+      float fx = fmaxf((x + 0.5f) * sx - 0.5f, 0.0f);
+      size_t x0 = (size_t)fx, x1 = x0 + 1 < width ? x0 + 1 : x0;
+      float tx = fx - x0;
+
+      const Color* c00 = &src[y0 * width + x0]; const Color* c10 = &src[y0 * width + x1];
+      const Color* c01 = &src[y1 * width + x0]; const Color* c11 = &src[y1 * width + x1];
+      float w00 = (1 - tx) * (1 - ty), w10 = tx * (1 - ty), w01 = (1 - tx) * ty, w11 = tx * ty;
+      dst[y * s_outputResolution[0] + x] = (Color){
+        (unsigned char)(c00->r * w00 + c10->r * w10 + c01->r * w01 + c11->r * w11 + 0.5f),
+        (unsigned char)(c00->g * w00 + c10->g * w10 + c01->g * w01 + c11->g * w11 + 0.5f),
+        (unsigned char)(c00->b * w00 + c10->b * w10 + c01->b * w01 + c11->b * w11 + 0.5f),
+        (unsigned char)(c00->a * w00 + c10->a * w10 + c01->a * w01 + c11->a * w11 + 0.5f)
+      };
+    }
+  }
+}
+
+bool engine_save_frame(const char* path)
+{
+  // Frames rendered below the output size are upscaled first
+  Color* pixels = s_pixelBuffer;
+  size_t count = s_outputResolution[0] * s_outputResolution[1];
+  if (s_pixelResolution[0] != s_outputResolution[0] || s_pixelResolution[1] != s_outputResolution[1])
+  {
+    pixels = (Color*)malloc(count * sizeof(Color));
+    engine_upscale(s_pixelBuffer, s_pixelResolution[0], s_pixelResolution[1], pixels);
+  }
+
+  bool ok = false;
+  const char* ext = strrchr(path, '.');
+  if (ext && strcmp(ext, ".png") == 0)
+  {
+    Image img = {
+      .data = pixels,
+      .width = (int)s_outputResolution[0],
+      .height = (int)s_outputResolution[1],
+      .mipmaps = 1,
+      .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+    };
+    ok = ExportImage(img, path);
+  }
+  else
+  {
+    // Anything else is written as raw tightly packed RGBA8 rows
+    FILE* f = fopen(path, "wb");
+    if (f)
+    {
+      ok = fwrite(pixels, sizeof(Color), count, f) == count;
+      fclose(f);
+    }
+    else printf("Cannot open frame file: %s\n", path);
+  }
+
+  if (pixels != s_pixelBuffer) free(pixels);
+  return ok;
+}
+
+void engine_set_dynamic_resolution(float targetMs, float minScale)
+{
+  s_dynamicTargetMs = targetMs > 0.0f ? targetMs : 0.0f;
+  s_minResolutionScale = fminf(fmaxf(minScale, 0.1f), 1.0f);
+}
+
+float engine_get_resolution_scale()
+{
+  return (float)s_screenResolution[0] / (float)s_outputResolution[0];
+}
+
+bool engine_is_native()
+{
+  return s_nativeBackend;
+}
+
+void engine_close()
+{
+  engine_pipeline_stop();
+  if (s_nativeBackend) cpu_raster_shutdown();
+  free(s_pixelBuffer);
+  arrfree(s_lights);
+
+  if (!s_headless)
+  {
+    UnloadTexture(s_outputTexture);
+    CloseWindow();
+  }
+
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+
+    clFinish(dev->queue);
+    clFinish(dev->readQueue);
+
+    for (int slot = 0; slot < FRAME_SLOTS; slot++)
+    {
+      engine_reset_stage_events(dev, slot);
+      if (dev->stagingFence[slot]) clReleaseEvent(dev->stagingFence[slot]);
+      free(dev->staging[slot]);
+      dev->stagingFence[slot] = NULL;
+      dev->staging[slot] = NULL;
+      dev->stagingSize[slot] = dev->stagingUsed[slot] = dev->stagingWanted[slot] = 0;
+
+      clEnqueueUnmapMemObject(dev->readQueue, dev->hostBuffers[slot], dev->hostPixels[slot], 0, NULL, NULL);
+    }
+    clFinish(dev->readQueue);
+
+    clReleaseKernel(dev->clearKernel);
+    clReleaseKernel(dev->vertexKernel);
+    for (int v = 0; v < FRAGMENT_VARIANTS; v++)
+    {
+      if (dev->variantKernels[v]) clReleaseKernel(dev->variantKernels[v]);
+      if (dev->resolveKernels[v]) clReleaseKernel(dev->resolveKernels[v]);
+      if (dev->variantPrograms[v]) clReleaseProgram(dev->variantPrograms[v]);
+    }
+    clReleaseKernel(dev->clearTilesKernel);
+    clReleaseKernel(dev->binKernel);
+    clReleaseKernel(dev->hizKernel);
+    clReleaseKernel(dev->hizReduceKernel);
+    clReleaseKernel(dev->lightBoundsKernel);
+    clReleaseKernel(dev->clusterLightsKernel);
+    if (dev->visibilityKernel) clReleaseKernel(dev->visibilityKernel);
+    clReleaseKernel(dev->setupKernel);
+    clReleaseKernel(dev->scanBlocksKernel);
+    clReleaseKernel(dev->scanBlockSumsKernel);
+    clReleaseKernel(dev->compactKernel);
+
+    for (int slot = 0; slot < FRAME_SLOTS; slot++)
+    {
+      clReleaseMemObject(dev->frameBuffers[slot]);
+      clReleaseMemObject(dev->hostBuffers[slot]);
+    }
+    clReleaseMemObject(dev->depthBuffer);
+    if (dev->visibilityBuffer) clReleaseMemObject(dev->visibilityBuffer);
+    clReleaseMemObject(dev->projectedVertsBuffer);
+    clReleaseMemObject(dev->projectionBuffer);
+    clReleaseMemObject(dev->viewBuffer);
+    clReleaseMemObject(dev->cameraPosBuffer);
+    clReleaseMemObject(dev->trianglesBuffer);
+    clReleaseMemObject(dev->verticesBuffer);
+    clReleaseMemObject(dev->pixelsBuffer);
+    clReleaseMemObject(dev->modelsBuffer);
+    clReleaseMemObject(dev->drawRangesBuffer);
+    clReleaseMemObject(dev->triMetaBuffer);
+    clReleaseMemObject(dev->tileCountsBuffer);
+    clReleaseMemObject(dev->tileTrisBuffer);
+    clReleaseMemObject(dev->tileDepthBuffer);
+    clReleaseMemObject(dev->hizGroupsBuffer);
+    clReleaseMemObject(dev->setupMetaBuffer);
+    clReleaseMemObject(dev->visibleFlagsBuffer);
+    clReleaseMemObject(dev->scanOffsetsBuffer);
+    clReleaseMemObject(dev->blockSumsBuffer);
+    clReleaseMemObject(dev->visibleCountBuffer);
+    clReleaseMemObject(dev->lightsBuffer);
+    clReleaseMemObject(dev->lightBoundsBuffer);
+    clReleaseMemObject(dev->clusterCountsBuffer);
+    clReleaseMemObject(dev->clusterLightsBuffer);
+
+    clReleaseProgram(dev->program);
+    clReleaseCommandQueue(dev->queue);
+    clReleaseCommandQueue(dev->readQueue);
+    clReleaseContext(dev->context);
+    clReleaseDevice(dev->device);
+  }
+  s_deviceCount = 0;
+
+  free(s_kernelSource);
+  s_kernelSource = NULL;
 
-static Triangle* s_allTriangles = NULL;
-static Color* s_allTexturePixels = NULL;
-static CustomModel* s_Models = NULL;
+  arrfree(s_frameRecords);
+  arrfree(s_traceRecords);
+}
 
-static size_t s_totalTriangles = 0;
-static size_t s_totalVerts = 0;
-static size_t s_totalTexturePixels = 0;
-static size_t s_triOffset = 0;
-static size_t s_pixOffset = 0;
+static int engine_morton_spread(int v)
+{
+  v = (v | (v << 2)) & 0x33;
+  return (v | (v << 1)) & 0x55;
+}
 
-static const char* engine_load_kernel(const char* filename)
+// Blocks of TEX_BLOCK x TEX_BLOCK texels in row-major order, Morton order
+// inside a block, so filter taps of nearby pixels share cache lines
+static size_t engine_texel_index(int x, int y, int width)
 {
-  FILE* f = fopen(filename, "rb");
-  if(!f) { printf("Cannot open kernel file.\n"); return NULL; }
-  fseek(f,0,SEEK_END);
-  size_t size = ftell(f);
-  fseek(f,0,SEEK_SET);
-  char* src = (char*)malloc(size+1);
-  fread(src,1,size,f);
-  src[size] = '\0';
-  fclose(f);
-  return src;
+  int blocksX = (width + TEX_BLOCK - 1) / TEX_BLOCK;
+  size_t block = (size_t)(y / TEX_BLOCK) * blocksX + (x / TEX_BLOCK);
+  return block * TEX_BLOCK * TEX_BLOCK
+       + (engine_morton_spread(x % TEX_BLOCK) | (engine_morton_spread(y % TEX_BLOCK) << 1));
 }
 
-void engine_init(const char* kernel,int width, int height)
+static size_t engine_texture_level_size(int width, int height)
 {
-  clGetPlatformIDs(1, &s_platform, NULL);
-  clGetDeviceIDs(s_platform, CL_DEVICE_TYPE_GPU, 1, &s_device, NULL);
+  return (size_t)((width + TEX_BLOCK - 1) / TEX_BLOCK) * ((height + TEX_BLOCK - 1) / TEX_BLOCK)
+       * TEX_BLOCK * TEX_BLOCK;
+}
 
-  s_context = clCreateContext(NULL, 1, &s_device, NULL, NULL, NULL);
-  s_queue = clCreateCommandQueue(s_context, s_device, 0, NULL);
-  
-  const char* kernelSource = engine_load_kernel(kernel); 
-  s_program = clCreateProgramWithSource(s_context, 1, &kernelSource, NULL, &s_err);
-  if (s_err != CL_SUCCESS) { printf("Error creating program: %d\n", s_err); }
+// 2x2 box filter, the last row/column is repeated for odd sizes
+static Color* engine_downsample(const Color* src, int width, int height, int* outWidth, int* outHeight)
+{
+  int w = width > 1 ? width / 2 : 1;
+  int h = height > 1 ? height / 2 : 1;
+  Color* dst = (Color*)malloc((size_t)w * h * sizeof(Color));
 
-  s_err = clBuildProgram(s_program, 1, &s_device, NULL, NULL, NULL);
-  if (s_err != CL_SUCCESS) {
-      size_t log_size;
-      clGetProgramBuildInfo(s_program, s_device, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size);
-      char* log = (char*)malloc(log_size);
-      clGetProgramBuildInfo(s_program, s_device, CL_PROGRAM_BUILD_LOG, log_size, log, NULL);
-      printf("OpenCL build error:\n%s\n", log);
-      free(log);
+  for (int y = 0; y < h; y++)
+  {
+    int y0 = 2 * y < height ? 2 * y : height - 1;
+    int y1 = 2 * y + 1 < height ? 2 * y + 1 : height - 1;
+    for (int x = 0; x < w; x++)
+    {
+      int x0 = 2 * x < width ? 2 * x : width - 1;
+      int x1 = 2 * x + 1 < width ? 2 * x + 1 : width - 1;
+      const Color* c[4] = { &src[y0 * width + x0], &src[y0 * width + x1],
+                            &src[y1 * width + x0], &src[y1 * width + x1] };
+      dst[y * w + x] = (Color){
+        (unsigned char)((c[0]->r + c[1]->r + c[2]->r + c[3]->r + 2) / 4),
+        (unsigned char)((c[0]->g + c[1]->g + c[2]->g + c[3]->g + 2) / 4),
+        (unsigned char)((c[0]->b + c[1]->b + c[2]->b + c[3]->b + 2) / 4),
+        (unsigned char)((c[0]->a + c[1]->a + c[2]->a + c[3]->a + 2) / 4)
+      };
+    }
   }
 
-  s_screenResolution[0] = width;
-  s_screenResolution[1] = height;
+  *outWidth = w;
+  *outHeight = h;
+  return dst;
+}
+
+static char* engine_copy_string(const char* str)
+{
+  size_t len = strlen(str) + 1;
+  char* copy = (char*)malloc(len);
+  memcpy(copy, str, len);
+  return copy;
+}
 
-  s_clearKernel    = clCreateKernel(s_program, "clear_buffers", NULL);
-  s_vertexKernel   = clCreateKernel(s_program, "vertex_kernel", NULL);
-  s_fragmentKernel = clCreateKernel(s_program, "fragment_kernel", NULL);
+static void engine_mesh_key(char* key, size_t size, const char* filePath, const char* texturePath)
+{
+  snprintf(key, size, "%s|%s", filePath, texturePath ? texturePath : "");
+}
 
-  s_frameBuffer = clCreateBuffer(s_context, CL_MEM_WRITE_ONLY, 
-                                      s_screenResolution[0] * s_screenResolution[1]
-                                              * sizeof(Color), NULL, NULL);
-  s_depthBuffer = clCreateBuffer(s_context, CL_MEM_READ_WRITE,
-                                      sizeof(cl_uint) * s_screenResolution[0]
-                                                    * s_screenResolution[1],
-                                                    NULL, &s_err);
+static void engine_free_job_data(LoadJob* job)
+{
+  if (job->cache.data) file_map_close(&job->cache);
+  else
+  {
+    arrfree(job->vertices);
+    arrfree(job->triangles);
+    arrfree(job->pixels);
+  }
+  job->vertices = NULL;
+  job->triangles = NULL;
+  job->pixels = NULL;
+}
 
-  clSetKernelArg(s_clearKernel, 0, sizeof(cl_mem), &s_frameBuffer);
-  clSetKernelArg(s_clearKernel, 1, sizeof(cl_mem), &s_depthBuffer);
-  clSetKernelArg(s_clearKernel, 2, sizeof(int), &s_screenResolution[0]);
-  clSetKernelArg(s_clearKernel, 3, sizeof(int), &s_screenResolution[1]);
-  clEnqueueNDRangeKernel(s_queue, s_clearKernel, 2, NULL, s_screenResolution, NULL, 0, NULL, NULL);
+static void engine_asset_cache_path(char* path, size_t pathSize, const char* source, const char* ext)
+{
+  uint64_t hash = engine_hash(14695981039346656037ull, source);
+  snprintf(path, pathSize, ASSET_CACHE_DIR "/%016llx.%s", (unsigned long long)hash, ext);
+}
 
-  clSetKernelArg(s_vertexKernel, 8, sizeof(int), &s_screenResolution[0]);
-  clSetKernelArg(s_vertexKernel, 9, sizeof(int), &s_screenResolution[1]);
+// Written next to the final name and renamed, so a concurrent or interrupted
+// run never maps a half-written file
+static void engine_write_asset_cache(const char* path, const void* header, size_t headerSize,
+                                     const void* a, size_t aSize, const void* b, size_t bSize)
+{
+  engine_mkdir(ASSET_CACHE_DIR);
 
-  clSetKernelArg(s_fragmentKernel, 0, sizeof(cl_mem), &s_frameBuffer);
-  clSetKernelArg(s_fragmentKernel, 2, sizeof(int), &s_screenResolution[0]);
-  clSetKernelArg(s_fragmentKernel, 3, sizeof(int), &s_screenResolution[1]);
-  clSetKernelArg(s_fragmentKernel, 4, sizeof(cl_mem), &s_depthBuffer);
+  char tmpPath[512];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE* f = fopen(tmpPath, "wb");
+  if (!f) return;
 
-  Image img = GenImageColor(s_screenResolution[0], s_screenResolution[1], s_backgroundColor);
-  s_outputTexture = LoadTextureFromImage(img);
-  free(img.data); // pixel buffer is managed by OpenCL
+  bool ok = fwrite(header, 1, headerSize, f) == headerSize;
+  if (ok && aSize) ok = fwrite(a, 1, aSize, f) == aSize;
+  if (ok && bSize) ok = fwrite(b, 1, bSize, f) == bSize;
+  fclose(f);
 
-  s_pixelBuffer = (Color*)malloc(s_screenResolution[0] * s_screenResolution[1] * sizeof(Color));
+  remove(path);
+  if (!ok || rename(tmpPath, path) != 0) remove(tmpPath);
 }
 
-void engine_background_color(Color color)
+static bool engine_map_cached_mesh(LoadJob* job)
 {
-  clSetKernelArg(s_clearKernel, 4, sizeof(Color), &color);
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!file_stat(job->path, &sourceSize, &sourceTime)) return false;
+
+  char path[512];
+  engine_asset_cache_path(path, sizeof(path), job->path, "mesh");
+  if (!file_map_open(&job->cache, path)) return false;
+
+  const MeshCacheHeader* header = (const MeshCacheHeader*)job->cache.data;
+  if (job->cache.size < sizeof(*header) ||
+      memcmp(header->magic, "GABM", 4) != 0 ||
+      header->version != ASSET_CACHE_VERSION ||
+      header->sourceSize != sourceSize || header->sourceTime != sourceTime ||
+      header->lodCount < 1 || header->lodCount > MESH_LOD_MAX ||
+      header->lodChain != (s_meshLods ? 1u : 0u) ||
+      job->cache.size != sizeof(*header) + header->numVertices * sizeof(Vertex)
+                                         + header->numTriangles * sizeof(Triangle))
+  {
+    file_map_close(&job->cache);
+    return false;
+  }
+
+  for (uint32_t l = 0; l < header->lodCount; l++)
+  {
+    const MeshLod* lod = &header->lods[l];
+    if ((uint64_t)lod->vertexOffset + lod->vertexCount > header->numVertices ||
+        (uint64_t)lod->triangleOffset + lod->triangleCount > header->numTriangles)
+    {
+      file_map_close(&job->cache);
+      return false;
+    }
+  }
+
+  job->numVertices = header->numVertices;
+  job->numTriangles = header->numTriangles;
+  job->lodCount = (int)header->lodCount;
+  memcpy(job->lods, header->lods, sizeof(job->lods));
+  job->vertices = (Vertex*)(header + 1);
+  job->triangles = (Triangle*)(job->vertices + job->numVertices);
+  job->boundsMin = header->boundsMin;
+  job->boundsMax = header->boundsMax;
+  job->ok = true;
+  return true;
 }
 
-void engine_clear_background()
+static void engine_store_cached_mesh(LoadJob* job)
 {
-  clEnqueueNDRangeKernel(s_queue, s_clearKernel, 2, NULL, s_screenResolution, NULL, 0, NULL, NULL);
+  MeshCacheHeader header = {0};
+  if (!file_stat(job->path, &header.sourceSize, &header.sourceTime)) return;
+  memcpy(header.magic, "GABM", 4);
+  header.version = ASSET_CACHE_VERSION;
+  header.numVertices = job->numVertices;
+  header.numTriangles = job->numTriangles;
+  header.boundsMin = job->boundsMin;
+  header.boundsMax = job->boundsMax;
+  header.lodChain = s_meshLods ? 1 : 0;
+  header.lodCount = (uint32_t)job->lodCount;
+  memcpy(header.lods, job->lods, sizeof(header.lods));
+
+  char path[512];
+  engine_asset_cache_path(path, sizeof(path), job->path, "mesh");
+  engine_write_asset_cache(path, &header, sizeof(header),
+                           job->vertices, job->numVertices * sizeof(Vertex),
+                           job->triangles, job->numTriangles * sizeof(Triangle));
 }
 
-void engine_send_camera_matrix()
+static bool engine_map_cached_texture(LoadJob* job)
 {
-  clEnqueueWriteBuffer(s_queue, s_cameraPosBuffer, CL_TRUE, 0,
-                       sizeof(f3), &s_camera.Position, 0, NULL, NULL);
-  clEnqueueWriteBuffer(s_queue, s_viewBuffer, CL_TRUE, 0,
-                       sizeof(f4x4), &s_camera.look_at, 0, NULL, NULL);
+  uint64_t sourceSize;
+  int64_t sourceTime;
+  if (!file_stat(job->path, &sourceSize, &sourceTime)) return false;
+
+  char path[512];
+  engine_asset_cache_path(path, sizeof(path), job->path, "tex");
+  if (!file_map_open(&job->cache, path)) return false;
+
+  const TextureCacheHeader* header = (const TextureCacheHeader*)job->cache.data;
+  if (job->cache.size < sizeof(*header) ||
+      memcmp(header->magic, "GABT", 4) != 0 ||
+      header->version != ASSET_CACHE_VERSION || header->block != TEX_BLOCK ||
+      header->sourceSize != sourceSize || header->sourceTime != sourceTime ||
+      job->cache.size != sizeof(*header) + header->numPixels * sizeof(Color))
+  {
+    file_map_close(&job->cache);
+    return false;
+  }
+
+  job->numPixels = header->numPixels;
+  job->pixels = (Color*)(header + 1);
+  job->width = header->width;
+  job->height = header->height;
+  job->levels = header->levels;
+  job->ok = true;
+  return true;
 }
 
-void engine_run_rasterizer()
+static void engine_store_cached_texture(LoadJob* job)
 {
-  clEnqueueNDRangeKernel(s_queue, s_vertexKernel, 1, NULL,
-                         &s_totalVerts, NULL, 0, NULL, NULL);
-  clEnqueueNDRangeKernel(s_queue, s_fragmentKernel, 2, NULL,
-                         s_screenResolution, NULL, 0, NULL, NULL);
+  TextureCacheHeader header = {0};
+  if (!file_stat(job->path, &header.sourceSize, &header.sourceTime)) return;
+  memcpy(header.magic, "GABT", 4);
+  header.version = ASSET_CACHE_VERSION;
+  header.numPixels = job->numPixels;
+  header.width = job->width;
+  header.height = job->height;
+  header.levels = job->levels;
+  header.block = TEX_BLOCK;
+
+  char path[512];
+  engine_asset_cache_path(path, sizeof(path), job->path, "tex");
+  engine_write_asset_cache(path, &header, sizeof(header),
+                           job->pixels, job->numPixels * sizeof(Color), NULL, 0);
 }
 
-void engine_read_and_display()
+// Decodes the image and builds its swizzled mip chain into job->pixels,
+// touches nothing shared so it can run on a loader thread
+static void engine_decode_texture(LoadJob* job)
 {
-  clEnqueueReadBuffer(s_queue, s_frameBuffer, CL_TRUE, 0,
-                      s_screenResolution[0] * s_screenResolution[1] * sizeof(Color),
-                      s_pixelBuffer, 0, NULL, NULL);
-  clFinish(s_queue);
+  if (engine_map_cached_texture(job)) return;
 
-  UpdateTexture(s_outputTexture, s_pixelBuffer);
-  BeginDrawing();
-  DrawTexture(s_outputTexture, 0, 0, WHITE);
-  EndDrawing();
-}
+  Image img = LoadImage(job->path);
+  if (img.width <= 0 || img.height <= 0) {
+      fprintf(stderr, "Failed to load texture: %s\n", job->path);
+      UnloadImage(img);
+      job->ok = false;
+      return;
+  }
 
-void engine_close()
-{
-  free(s_pixelBuffer);
+  job->width = img.width;
+  job->height = img.height;
+  job->levels = 0;
+
+  int width = img.width, height = img.height;
+  Color* level = (Color*)malloc((size_t)width * height * sizeof(Color));
+  memcpy(level, img.data, (size_t)width * height * sizeof(Color));
+  UnloadImage(img); // free Raylib image memory
 
-  UnloadTexture(s_outputTexture);
-  CloseWindow();
+  // Full chain down to 1x1, one block-swizzled level after another
+  for (;;)
+  {
+    size_t levelSize = engine_texture_level_size(width, height);
+    Color* dst = arraddnptr(job->pixels, levelSize);
+    memset(dst, 0, levelSize * sizeof(Color));
+
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        dst[engine_texel_index(x, y, width)] = level[y * width + x];
+    job->levels++;
 
-  clReleaseDevice(s_device);
-  clReleaseProgram(s_program);
-  clReleaseCommandQueue(s_queue);
-  clReleaseContext(s_context);
+    if (width == 1 && height == 1) break;
 
-  clReleaseKernel(s_clearKernel);
-  clReleaseKernel(s_vertexKernel);
-  clReleaseKernel(s_fragmentKernel);
+    Color* next = engine_downsample(level, width, height, &width, &height);
+    free(level);
+    level = next;
+  }
+  free(level);
 
-  clReleaseMemObject(s_frameBuffer);
-  clReleaseMemObject(s_depthBuffer);
-  clReleaseMemObject(s_projectedVertsBuffer);
-  clReleaseMemObject(s_projectionBuffer);
-  clReleaseMemObject(s_viewBuffer);
-  clReleaseMemObject(s_cameraPosBuffer);
-  clReleaseMemObject(s_trianglesBuffer);
-  clReleaseMemObject(s_pixelsBuffer);
-  clReleaseMemObject(s_modelsBuffer);
+  job->numPixels = arrlen(job->pixels);
+  job->ok = true;
+  engine_store_cached_texture(job);
 }
 
-void engine_load_model(const char* filePath, const char* texturePath, f4x4 transform)
+// Imports every sub-mesh of the file into job-local arrays, sized up front
+static void engine_import_mesh(LoadJob* job)
 {
+  if (engine_map_cached_mesh(job)) return;
+
   const struct aiScene* scene = aiImportFile(
-      filePath,
+      job->path,
       aiProcess_Triangulate |
       aiProcess_JoinIdenticalVertices |
       aiProcess_GenSmoothNormals |
@@ -253,156 +2761,733 @@ void engine_load_model(const char* filePath, const char* texturePath, f4x4 trans
   );
 
   if (!scene || scene->mNumMeshes == 0) {
-      fprintf(stderr, "Failed to load model: %s\n", filePath);
+      fprintf(stderr, "Failed to load model: %s\n", job->path);
       aiReleaseImport(scene);
+      job->ok = false;
       return;
   }
 
-  Triangle* triangles = NULL;
-  size_t numTriangles = 0;
-  size_t numVertices = 0;
+  size_t numVertices = 0, numFaces = 0;
+  for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+      numVertices += scene->mMeshes[m]->mNumVertices;
+      numFaces += scene->mMeshes[m]->mNumFaces;
+  }
+  arrsetlen(job->vertices, numVertices);
+  arrsetcap(job->triangles, numFaces);
 
-  int modelIndex = arrlen(s_Models);
+  job->boundsMin = (f3){ FLT_MAX, FLT_MAX, FLT_MAX };
+  job->boundsMax = (f3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
 
+  int meshBase = 0;
   for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
-      const struct aiMesh* mesh = scene->mMeshes[m];
+      const struct aiMesh* aimesh = scene->mMeshes[m];
+
+      for (unsigned int v = 0; v < aimesh->mNumVertices; v++) {
+          Vertex vert = {0};
 
-      for (unsigned int f = 0; f < mesh->mNumFaces; f++) {
-          const struct aiFace* face = &mesh->mFaces[f];
+          if (aimesh->mVertices) {
+              vert.position.x = aimesh->mVertices[v].x;
+              vert.position.y = aimesh->mVertices[v].y;
+              vert.position.z = aimesh->mVertices[v].z;
+          }
+          if (aimesh->mNormals) {
+              vert.normal.x = aimesh->mNormals[v].x;
+              vert.normal.y = aimesh->mNormals[v].y;
+              vert.normal.z = aimesh->mNormals[v].z;
+          }
+          if (aimesh->mTextureCoords[0]) {
+              vert.uv.x = aimesh->mTextureCoords[0][v].x;
+              vert.uv.y = aimesh->mTextureCoords[0][v].y;
+          }
+
+          job->boundsMin.x = fminf(job->boundsMin.x, vert.position.x);
+          job->boundsMin.y = fminf(job->boundsMin.y, vert.position.y);
+          job->boundsMin.z = fminf(job->boundsMin.z, vert.position.z);
+          job->boundsMax.x = fmaxf(job->boundsMax.x, vert.position.x);
+          job->boundsMax.y = fmaxf(job->boundsMax.y, vert.position.y);
+          job->boundsMax.z = fmaxf(job->boundsMax.z, vert.position.z);
+
+          job->vertices[meshBase + v] = vert;
+      }
+
+      for (unsigned int f = 0; f < aimesh->mNumFaces; f++) {
+          const struct aiFace* face = &aimesh->mFaces[f];
           if (face->mNumIndices != 3) continue; // skip non-triangles
 
           Triangle tri = {0};
-          for (int i = 0; i < 3; i++) {
-              unsigned int idx = face->mIndices[i];
-
-              if (mesh->mVertices) {
-                  tri.vertex[i].x = mesh->mVertices[idx].x;
-                  tri.vertex[i].y = mesh->mVertices[idx].y;
-                  tri.vertex[i].z = mesh->mVertices[idx].z;
-              }
-              if (mesh->mNormals) {
-                  tri.normal[i].x = mesh->mNormals[idx].x;
-                  tri.normal[i].y = mesh->mNormals[idx].y;
-                  tri.normal[i].z = mesh->mNormals[idx].z;
-              }
-              if (mesh->mTextureCoords[0]) {
-                  tri.uv[i].x = mesh->mTextureCoords[0][idx].x;
-                  tri.uv[i].y = mesh->mTextureCoords[0][idx].y;
-              }
-          }
-          
-          tri.modelIdx = modelIndex;
+          for (int i = 0; i < 3; i++)
+              tri.indices[i] = meshBase + (int)face->mIndices[i];
 
-          arrpush(triangles, tri);
-          numTriangles++;
-          numVertices += 3;
+          arrpush(job->triangles, tri); // within the reserved capacity
       }
+
+      meshBase += (int)aimesh->mNumVertices;
   }
 
   aiReleaseImport(scene);
 
-  int texWidth = 0, texHeight = 0;
-  Color* pixels = NULL;
+  // Simplified levels go after the import in the same arrays, and into the cache
+  job->lodCount = 1;
+  job->lods[0] = (MeshLod){ 0, (int)arrlen(job->triangles), 0, (int)arrlen(job->vertices) };
+  if (s_meshLods) job->lodCount = mesh_build_lods(&job->vertices, &job->triangles, job->lods);
+
+  job->numVertices = arrlen(job->vertices);
+  job->numTriangles = arrlen(job->triangles);
+  job->ok = true;
+  engine_store_cached_mesh(job);
+}
+
+// The merges run on the main thread only, each result is appended to the
+// shared arrays in one reserve + memcpy
+static int engine_merge_texture(LoadJob* job)
+{
+  if (!s_textureLookup) sh_new_strdup(s_textureLookup);
+
+  int cached = shgeti(s_textureLookup, job->path);
+  if (cached >= 0) return s_textureLookup[cached].value; // loaded meanwhile
+  if (!job->ok) return -1;
+
+  CustomTexture tex;
+  tex.pixelOffset = (int)arrlen(s_allTexturePixels);
+  tex.width = job->width;
+  tex.height = job->height;
+  tex.levels = job->levels;
+
+  memcpy(arraddnptr(s_allTexturePixels, job->numPixels), job->pixels, job->numPixels * sizeof(Color));
+
+  int index = (int)arrlen(s_textures);
+  arrpush(s_textures, tex);
+  shput(s_textureLookup, job->path, index);
+  return index;
+}
+
+// Round-to-nearest float to IEEE half, what vload_half reads back
+static uint16_t engine_float_to_half(float value)
+{
+  union { float f; uint32_t u; } bits = { value };
+  uint32_t sign = (bits.u >> 16) & 0x8000;
+  int exponent = (int)((bits.u >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits.u & 0x7fffff;
+
+  if (exponent >= 31) return (uint16_t)(sign | 0x7c00); // overflow and inf/nan
+  if (exponent <= 0)
+  {
+    if (exponent < -10) return (uint16_t)sign;
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    return (uint16_t)(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+  }
+  // A mantissa carry rolls into the exponent, which is the correct rounding
+  return (uint16_t)(sign + (((uint32_t)exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+}
+
+// Octahedral normal, x in the low byte and y in the high byte as snorm8
+static uint16_t engine_encode_normal(f3 n)
+{
+  float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  if (sum <= 0.0f) return 0;
+
+  float x = n.x / sum, y = n.y / sum;
+  if (n.z < 0.0f)
+  {
+    float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx; y = fy;
+  }
+
+  int8_t qx = (int8_t)lroundf(fminf(fmaxf(x, -1.0f), 1.0f) * 127.0f);
+  int8_t qy = (int8_t)lroundf(fminf(fmaxf(y, -1.0f), 1.0f) * 127.0f);
+  return (uint16_t)((uint8_t)qx | ((uint16_t)(uint8_t)qy << 8));
+}
+
+static uint16_t engine_quantize(float v, float min, float scale)
+{
+  if (scale <= 0.0f) return 0;
+  float q = (v - min) / scale;
+  return (uint16_t)lroundf(fminf(fmaxf(q, 0.0f), 65535.0f));
+}
+
+// Quantization step per axis over the mesh bounds, matching quantScale
+static f3 engine_quant_scale(const CustomMesh* mesh)
+{
+  return (f3){ (mesh->boundsMax.x - mesh->boundsMin.x) / 65535.0f,
+               (mesh->boundsMax.y - mesh->boundsMin.y) / 65535.0f,
+               (mesh->boundsMax.z - mesh->boundsMin.z) / 65535.0f };
+}
+
+static void engine_pack_vertices(const CustomMesh* mesh, const Vertex* src, PackedVertex* dst, size_t count)
+{
+  f3 scale = engine_quant_scale(mesh);
+  for (size_t v = 0; v < count; v++)
+  {
+    dst[v].position[0] = engine_quantize(src[v].position.x, mesh->boundsMin.x, scale.x);
+    dst[v].position[1] = engine_quantize(src[v].position.y, mesh->boundsMin.y, scale.y);
+    dst[v].position[2] = engine_quantize(src[v].position.z, mesh->boundsMin.z, scale.z);
+    dst[v].normal = engine_encode_normal(src[v].normal);
+    dst[v].uv[0] = engine_float_to_half(src[v].uv.x);
+    dst[v].uv[1] = engine_float_to_half(src[v].uv.y);
+  }
+}
+
+static int engine_merge_mesh(LoadJob* job, int texture)
+{
+  if (!s_meshLookup) sh_new_strdup(s_meshLookup);
+
+  char key[1024];
+  engine_mesh_key(key, sizeof(key), job->path, job->texturePath);
+
+  int cached = shgeti(s_meshLookup, key);
+  if (cached >= 0) return s_meshLookup[cached].value;
+  if (!job->ok) return -1;
+
+  int meshIndex = (int)arrlen(s_meshes);
+  size_t numTriangles = job->numTriangles;
+  size_t numVertices = job->numVertices;
+
+  CustomMesh mesh;
+  mesh.triangleOffset = (int)arrlen(s_allTriangles) + job->lods[0].triangleOffset;
+  mesh.triangleCount  = job->lods[0].triangleCount;
+  mesh.vertexOffset   = (int)arrlen(s_allVertices) + job->lods[0].vertexOffset;
+  mesh.vertexCount    = job->lods[0].vertexCount;
+  mesh.texture        = texture;
+  mesh.boundsMin      = job->boundsMin;
+  mesh.boundsMax      = job->boundsMax;
+  mesh.lodCount       = job->lodCount;
+  for (int l = 0; l < job->lodCount; l++)
+  {
+    mesh.lods[l] = job->lods[l];
+    mesh.lods[l].triangleOffset += (int)arrlen(s_allTriangles);
+    mesh.lods[l].vertexOffset += (int)arrlen(s_allVertices);
+  }
+  if (mesh.lodCount > 1)
+    printf("%s: %d LODs, %d -> %d triangles\n", job->path, mesh.lodCount,
+           mesh.triangleCount, mesh.lods[mesh.lodCount - 1].triangleCount);
+
+  // Straight from the import or the mapped cache, meshIdx is patched in place
+  if (numTriangles > 0)
+  {
+      Triangle* dst = arraddnptr(s_allTriangles, numTriangles);
+      memcpy(dst, job->triangles, numTriangles * sizeof(Triangle));
+      for (size_t t = 0; t < numTriangles; t++)
+          dst[t].meshIdx = meshIndex;
+  }
+  if (numVertices > 0)
+  {
+      memcpy(arraddnptr(s_allVertices, numVertices), job->vertices, numVertices * sizeof(Vertex));
+      if (s_packedVertices)
+          engine_pack_vertices(&mesh, job->vertices, arraddnptr(s_allPackedVertices, numVertices), numVertices);
+  }
+
+  arrpush(s_meshes, mesh);
+  shput(s_meshLookup, key, meshIndex);
+  return meshIndex;
+}
+
+static int engine_load_texture(const char* texturePath)
+{
+  if (!s_textureLookup) sh_new_strdup(s_textureLookup);
+
+  int cached = shgeti(s_textureLookup, texturePath);
+  if (cached >= 0) return s_textureLookup[cached].value;
+
+  LoadJob job = {0};
+  job.kind = LOAD_TEXTURE;
+  job.path = (char*)texturePath;
+  engine_decode_texture(&job);
+
+  engine_scene_lock();
+  int index = engine_merge_texture(&job);
+  engine_scene_unlock();
+  engine_free_job_data(&job);
+  return index;
+}
+
+int engine_load_mesh(const char* filePath, const char* texturePath)
+{
+  if (!s_meshLookup) sh_new_strdup(s_meshLookup);
+
+  char key[1024];
+  engine_mesh_key(key, sizeof(key), filePath, texturePath);
+
+  int cached = shgeti(s_meshLookup, key);
+  if (cached >= 0) return s_meshLookup[cached].value;
+
+  LoadJob job = {0};
+  job.kind = LOAD_MESH;
+  job.path = (char*)filePath;
+  job.texturePath = (char*)texturePath;
+  engine_import_mesh(&job);
+
+  int texture = job.ok && texturePath ? engine_load_texture(texturePath) : -1;
+  engine_scene_lock();
+  int index = engine_merge_mesh(&job, texture);
+  engine_scene_unlock();
+  engine_free_job_data(&job);
+  return index;
+}
+
+
+static int engine_load_worker(void* arg)
+{
+  mtx_lock(&s_loadMutex);
+  for (;;)
+  {
+    while (!s_loadShutdown && s_loadNextJob >= arrlen(s_loadJobs))
+      cnd_wait(&s_loadWork, &s_loadMutex);
+    if (s_loadShutdown) break;
+
+    LoadJob* job = s_loadJobs[s_loadNextJob++];
+    mtx_unlock(&s_loadMutex);
+
+    if (job->kind == LOAD_MESH) engine_import_mesh(job);
+    else engine_decode_texture(job);
+
+    mtx_lock(&s_loadMutex);
+    job->done = true;
+    cnd_broadcast(&s_loadDone);
+  }
+  mtx_unlock(&s_loadMutex);
+  return 0;
+}
+
+static void engine_start_loader()
+{
+  if (s_loadThreadCount > 0) return;
+
+  mtx_init(&s_loadMutex, mtx_plain);
+  cnd_init(&s_loadWork);
+  cnd_init(&s_loadDone);
+  s_loadShutdown = false;
+
+  int count = engine_cpu_count();
+  if (count > MAX_LOAD_THREADS) count = MAX_LOAD_THREADS;
+  for (int i = 0; i < count; i++)
+    if (thrd_create(&s_loadThreads[s_loadThreadCount], engine_load_worker, NULL) == thrd_success)
+      s_loadThreadCount++;
+}
+
+static void engine_stop_loader()
+{
+  if (s_loadThreadCount == 0) return;
+
+  mtx_lock(&s_loadMutex);
+  s_loadShutdown = true;
+  cnd_broadcast(&s_loadWork);
+  mtx_unlock(&s_loadMutex);
+
+  for (int i = 0; i < s_loadThreadCount; i++)
+    thrd_join(s_loadThreads[i], NULL);
+  s_loadThreadCount = 0;
+
+  cnd_destroy(&s_loadWork);
+  cnd_destroy(&s_loadDone);
+  mtx_destroy(&s_loadMutex);
+}
 
-  if (texturePath) {
-      Image img = LoadImage(texturePath);
-      texWidth = img.width;
-      texHeight = img.height;
+static int engine_submit_job(LoadKind kind, const char* path, const char* texturePath, int textureJob)
+{
+  LoadJob* job = (LoadJob*)calloc(1, sizeof(LoadJob));
+  job->kind = kind;
+  job->path = engine_copy_string(path);
+  job->texturePath = texturePath ? engine_copy_string(texturePath) : NULL;
+  job->textureJob = textureJob;
+
+  mtx_lock(&s_loadMutex);
+  int index = (int)arrlen(s_loadJobs);
+  arrpush(s_loadJobs, job);
+  cnd_signal(&s_loadWork);
+  mtx_unlock(&s_loadMutex);
+  return index;
+}
+
+void engine_load_model_async(const char* filePath, const char* texturePath, f4x4 transform)
+{
+  engine_start_loader();
+  if (!s_pendingMeshes) sh_new_strdup(s_pendingMeshes);
+  if (!s_pendingTextures) sh_new_strdup(s_pendingTextures);
 
-      if (texWidth > 0 && texHeight > 0) {
-          pixels = (Color*)malloc(texWidth * texHeight * sizeof(Color));
-          memcpy(pixels, img.data, texWidth * texHeight * sizeof(Color));
+  LoadRequest request = { -1, -1, transform };
+
+  char key[1024];
+  engine_mesh_key(key, sizeof(key), filePath, texturePath);
+
+  int loaded = s_meshLookup ? shgeti(s_meshLookup, key) : -1;
+  int pending = shgeti(s_pendingMeshes, key);
+
+  if (loaded >= 0) request.mesh = s_meshLookup[loaded].value;
+  else if (pending >= 0) request.meshJob = s_pendingMeshes[pending].value;
+  else
+  {
+    // Textures get their own job so a shared image is decoded once and in
+    // parallel with the meshes using it
+    int textureJob = -1;
+    if (texturePath && !(s_textureLookup && shgeti(s_textureLookup, texturePath) >= 0))
+    {
+      int pendingTexture = shgeti(s_pendingTextures, texturePath);
+      if (pendingTexture >= 0) textureJob = s_pendingTextures[pendingTexture].value;
+      else
+      {
+        textureJob = engine_submit_job(LOAD_TEXTURE, texturePath, NULL, -1);
+        shput(s_pendingTextures, texturePath, textureJob);
       }
+    }
+
+    request.meshJob = engine_submit_job(LOAD_MESH, filePath, texturePath, textureJob);
+    shput(s_pendingMeshes, key, request.meshJob);
+  }
+
+  arrpush(s_loadRequests, request);
+}
+
+// Merges finished jobs strictly in submission order, so the layout of the
+// shared arrays does not depend on which thread finished first
+int engine_poll_loads()
+{
+  if (s_loadThreadCount == 0) return 0;
+
+  mtx_lock(&s_loadMutex);
+  int total = (int)arrlen(s_loadJobs);
+  int ready = s_loadMerged;
+  while (ready < total && s_loadJobs[ready]->done) ready++;
+  mtx_unlock(&s_loadMutex);
 
-      UnloadImage(img); // free Raylib image memory
+  engine_scene_lock();
+
+  for (; s_loadMerged < ready; s_loadMerged++)
+  {
+    LoadJob* job = s_loadJobs[s_loadMerged];
+    if (job->kind == LOAD_TEXTURE) job->result = engine_merge_texture(job);
+    else
+    {
+      int texture = job->textureJob >= 0 ? s_loadJobs[job->textureJob]->result
+                  : job->texturePath && job->ok ? engine_load_texture(job->texturePath) : -1;
+      job->result = engine_merge_mesh(job, texture);
+    }
+    engine_free_job_data(job);
+  }
+
+  int numRequests = (int)arrlen(s_loadRequests);
+  for (; s_loadRequestsDone < numRequests; s_loadRequestsDone++)
+  {
+    LoadRequest* request = &s_loadRequests[s_loadRequestsDone];
+    if (request->meshJob >= 0)
+    {
+      if (request->meshJob >= s_loadMerged) break;
+      request->mesh = s_loadJobs[request->meshJob]->result;
+    }
+    if (request->mesh >= 0) engine_add_instance(request->mesh, request->transform);
+  }
+  engine_scene_unlock();
+
+  int remaining = numRequests - s_loadRequestsDone;
+  if (remaining == 0 && s_loadMerged == total)
+  {
+    // Batch drained, every worker is idle again
+    mtx_lock(&s_loadMutex);
+    for (int i = 0; i < total; i++)
+    {
+      free(s_loadJobs[i]->path);
+      free(s_loadJobs[i]->texturePath);
+      free(s_loadJobs[i]);
+    }
+    arrfree(s_loadJobs);
+    s_loadNextJob = 0;
+    mtx_unlock(&s_loadMutex);
+
+    arrfree(s_loadRequests);
+    s_loadMerged = 0;
+    s_loadRequestsDone = 0;
+    shfree(s_pendingMeshes);
+    shfree(s_pendingTextures);
+  }
+
+  return remaining;
+}
+
+void engine_wait_loads()
+{
+  while (engine_poll_loads() > 0)
+  {
+    mtx_lock(&s_loadMutex);
+    if (s_loadMerged < arrlen(s_loadJobs) && !s_loadJobs[s_loadMerged]->done)
+      cnd_wait(&s_loadDone, &s_loadMutex);
+    mtx_unlock(&s_loadMutex);
+  }
+}
+
+// World AABB of the transformed object-space box, sphere around that box
+static ModelBounds engine_instance_bounds(const CustomMesh* mesh, const f4x4* transform)
+{
+  // The 8 corners go through the batch transform as one SoA block
+  float cx[8], cy[8], cz[8], wx[8], wy[8], wz[8];
+  for (int c = 0; c < 8; c++)
+  {
+    cx[c] = (c & 1) ? mesh->boundsMax.x : mesh->boundsMin.x;
+    cy[c] = (c & 2) ? mesh->boundsMax.y : mesh->boundsMin.y;
+    cz[c] = (c & 4) ? mesh->boundsMax.z : mesh->boundsMin.z;
+  }
+  MatTransformPoints(transform, (f3SoA){ cx, cy, cz }, (f4SoA){ wx, wy, wz, NULL }, 8);
+
+  ModelBounds b;
+  b.min = (f3){ FLT_MAX, FLT_MAX, FLT_MAX };
+  b.max = (f3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for (int c = 0; c < 8; c++)
+  {
+    b.min = (f3){ fminf(b.min.x, wx[c]), fminf(b.min.y, wy[c]), fminf(b.min.z, wz[c]) };
+    b.max = (f3){ fmaxf(b.max.x, wx[c]), fmaxf(b.max.y, wy[c]), fmaxf(b.max.z, wz[c]) };
   }
 
-  for (size_t t = 0; t < numTriangles; t++)
-      arrpush(s_allTriangles, triangles[t]);
+  b.center = (f3){ (b.min.x + b.max.x) * 0.5f, (b.min.y + b.max.y) * 0.5f, (b.min.z + b.max.z) * 0.5f };
+  b.radius = 0.5f * sqrtf((b.max.x - b.min.x) * (b.max.x - b.min.x) +
+                          (b.max.y - b.min.y) * (b.max.y - b.min.y) +
+                          (b.max.z - b.min.z) * (b.max.z - b.min.z));
+  return b;
+}
 
-  if (pixels) {
-      size_t numPixels = texWidth * texHeight;
-      for (size_t p = 0; p < numPixels; p++)
-          arrpush(s_allTexturePixels, pixels[p]);
-      free(pixels);
+int engine_add_instance(int mesh, f4x4 transform)
+{
+  if (mesh < 0 || mesh >= arrlen(s_meshes)) {
+      fprintf(stderr, "Invalid mesh index: %d\n", mesh);
+      return -1;
   }
 
+  engine_scene_lock();
+  const CustomMesh* src = &s_meshes[mesh];
+
   CustomModel m;
-  m.triangleOffset = s_triOffset;
-  m.triangleCount  = (int)numTriangles;
-  m.vertexOffset   = 0;
-  m.vertexCount    = (int)numVertices;
-  m.pixelOffset    = s_pixOffset;
-  m.texWidth       = texWidth;
-  m.texHeight      = texHeight;
-  m.transform      = transform;
+  m.triangleCount      = src->triangleCount;
+  m.vertexCount        = src->vertexCount;
+  m.meshTriangleOffset = src->triangleOffset;
+  m.meshVertexOffset   = src->vertexOffset;
+  m.pixelOffset        = src->texture >= 0 ? s_textures[src->texture].pixelOffset : 0;
+  m.texWidth           = src->texture >= 0 ? s_textures[src->texture].width : 0;
+  m.texHeight          = src->texture >= 0 ? s_textures[src->texture].height : 0;
+  m.texLevels          = src->texture >= 0 ? s_textures[src->texture].levels : 0;
+  m.quantMin           = src->boundsMin;
+  m.quantScale         = engine_quant_scale(src);
+  m.transform          = transform;
+
+  s_totalTriangles += src->triangleCount;
+  s_totalVerts += src->vertexCount;
+
+  int index = (int)arrlen(s_Models);
   arrpush(s_Models, m);
+  arrpush(s_modelBounds, engine_instance_bounds(src, &transform));
+  arrpush(s_modelMeshes, mesh);
+  arrpush(s_modelLods, 0);
+  engine_scene_unlock();
+  return index;
+}
+
+void engine_set_model_transform(int instance, f4x4 transform)
+{
+  if (instance < 0 || instance >= arrlen(s_Models)) return;
+
+  engine_scene_lock();
+  s_Models[instance].transform = transform;
+  s_modelBounds[instance] = engine_instance_bounds(&s_meshes[s_modelMeshes[instance]], &transform);
+  s_bvhDirty = true;
 
-  s_triOffset += numTriangles;
-  s_pixOffset += texWidth * texHeight;
-  s_totalTriangles += numTriangles;
-  s_totalTexturePixels += texWidth * texHeight;
+  if (instance < s_dirtyFirst) s_dirtyFirst = instance;
+  if (instance > s_dirtyLast) s_dirtyLast = instance;
+  engine_scene_unlock();
+}
 
-  arrfree(triangles);
+void engine_load_model(const char* filePath, const char* texturePath, f4x4 transform)
+{
+  engine_add_instance(engine_load_mesh(filePath, texturePath), transform);
 }
 
-void engine_upload_models_data()
-{  
-  int numModels = arrlen(s_Models);
-  s_totalVerts = s_totalTriangles * 3;
+static void engine_bind_model_buffers(RenderDevice* dev)
+{
+  clSetKernelArg(dev->vertexKernel, 0, sizeof(cl_mem), &dev->verticesBuffer);
+  clSetKernelArg(dev->vertexKernel, 1, sizeof(cl_mem), &dev->modelsBuffer);
+  clSetKernelArg(dev->vertexKernel, 2, sizeof(cl_mem), &dev->drawRangesBuffer);
+  clSetKernelArg(dev->vertexKernel, 5, sizeof(cl_mem), &dev->projectedVertsBuffer);
+
+  engine_bind_variant_args(dev);
+
+  clSetKernelArg(dev->setupKernel, 0, sizeof(cl_mem), &dev->projectedVertsBuffer);
+  clSetKernelArg(dev->setupKernel, 1, sizeof(cl_mem), &dev->trianglesBuffer);
+  clSetKernelArg(dev->setupKernel, 2, sizeof(cl_mem), &dev->modelsBuffer);
+  clSetKernelArg(dev->setupKernel, 3, sizeof(cl_mem), &dev->drawRangesBuffer);
+  clSetKernelArg(dev->setupKernel, 6, sizeof(cl_mem), &dev->setupMetaBuffer);
+  clSetKernelArg(dev->setupKernel, 7, sizeof(cl_mem), &dev->visibleFlagsBuffer);
+
+  clSetKernelArg(dev->scanBlocksKernel, 0, sizeof(cl_mem), &dev->visibleFlagsBuffer);
+  clSetKernelArg(dev->scanBlocksKernel, 1, sizeof(cl_mem), &dev->scanOffsetsBuffer);
+  clSetKernelArg(dev->scanBlocksKernel, 2, sizeof(cl_mem), &dev->blockSumsBuffer);
+
+  clSetKernelArg(dev->scanBlockSumsKernel, 0, sizeof(cl_mem), &dev->blockSumsBuffer);
+  clSetKernelArg(dev->scanBlockSumsKernel, 2, sizeof(cl_mem), &dev->visibleCountBuffer);
 
-  s_trianglesBuffer = clCreateBuffer(s_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        arrlen(s_allTriangles) * sizeof(Triangle), s_allTriangles, &s_err);
+  clSetKernelArg(dev->compactKernel, 0, sizeof(cl_mem), &dev->setupMetaBuffer);
+  clSetKernelArg(dev->compactKernel, 1, sizeof(cl_mem), &dev->visibleFlagsBuffer);
+  clSetKernelArg(dev->compactKernel, 2, sizeof(cl_mem), &dev->scanOffsetsBuffer);
+  clSetKernelArg(dev->compactKernel, 3, sizeof(cl_mem), &dev->blockSumsBuffer);
+  clSetKernelArg(dev->compactKernel, 4, sizeof(cl_mem), &dev->triMetaBuffer);
 
-  s_pixelsBuffer = clCreateBuffer(s_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        arrlen(s_allTexturePixels) * sizeof(Color), s_allTexturePixels, &s_err);
+  clSetKernelArg(dev->hizKernel, 0, sizeof(cl_mem), &dev->triMetaBuffer);
+  clSetKernelArg(dev->hizKernel, 1, sizeof(cl_mem), &dev->visibleCountBuffer);
 
-  s_modelsBuffer = clCreateBuffer(s_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        arrlen(s_Models) * sizeof(CustomModel), s_Models, &s_err);
+  clSetKernelArg(dev->binKernel, 0, sizeof(cl_mem), &dev->triMetaBuffer);
+  clSetKernelArg(dev->binKernel, 1, sizeof(cl_mem), &dev->visibleCountBuffer);
+
+  if (dev->visibilityKernel)
+  {
+    clSetKernelArg(dev->visibilityKernel, 0, sizeof(cl_mem), &dev->triMetaBuffer);
+    clSetKernelArg(dev->visibilityKernel, 1, sizeof(cl_mem), &dev->visibleCountBuffer);
+  }
+}
+
+// Brings the devices up to date with the host arrays. Only data appended since
+// the last call and the span of moved instances is written, buffers grow
+// geometrically and keep what they already hold. Called again by
+// engine_run_rasterizer whenever models stream in or move. When a device
+// cannot grow a buffer nothing is written or marked uploaded, the next call
+// retries and false tells the caller not to draw with the new counts
+bool engine_upload_models_data()
+{
+  size_t numTriangles = arrlen(s_allTriangles);
+  size_t numVertices = arrlen(s_allVertices);
+  size_t numPixels = arrlen(s_allTexturePixels);
+  size_t numModels = arrlen(s_Models);
+  size_t numScanBlocks = (s_totalTriangles + SCAN_BLOCK - 1) / SCAN_BLOCK;
+  size_t vertexSize = s_packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+  const char* vertices = s_packedVertices ? (const char*)s_allPackedVertices : (const char*)s_allVertices;
+
+  int texturedModels = 0;
+  for (size_t m = 0; m < numModels; m++)
+    if (s_Models[m].texWidth > 0 && s_Models[m].texHeight > 0) texturedModels++;
+  s_textureMode = texturedModels == (int)numModels ? TEXTURE_MODE_ALL
+                : texturedModels == 0             ? TEXTURE_MODE_NONE
+                :                                   TEXTURE_MODE_ANY;
+
+  BufferCapacity old = s_capacity;
+  BufferCapacity capacity;
+  capacity.triangles     = engine_grow_capacity(old.triangles, numTriangles);
+  capacity.vertices      = engine_grow_capacity(old.vertices, numVertices);
+  capacity.pixels        = engine_grow_capacity(old.pixels, numPixels);
+  capacity.models        = engine_grow_capacity(old.models, numModels);
+  capacity.instanceVerts = engine_grow_capacity(old.instanceVerts, s_totalVerts);
+  capacity.instanceTris  = engine_grow_capacity(old.instanceTris, s_totalTriangles);
+  capacity.scanBlocks    = engine_grow_capacity(old.scanBlocks, numScanBlocks);
+
+  // Dirty transforms of instances already on the device, new ones go below
+  size_t dirtyFirst = s_dirtyLast >= 0 ? (size_t)s_dirtyFirst : s_uploadedModels;
+  size_t dirtyLast = s_dirtyLast >= 0 ? (size_t)s_dirtyLast + 1 : s_uploadedModels;
+  if (dirtyFirst > s_uploadedModels) dirtyFirst = s_uploadedModels;
+  if (dirtyLast > s_uploadedModels) dirtyLast = s_uploadedModels;
+
+  // Every device grows its buffers first, buffers that did grow are rebound
+  // even if another one failed, since their old cl_mem is released
+  bool resized = true;
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+    bool ok = true;
+
+    // Mesh and texture data once, only the per-instance streams scale with instances
+    ok = engine_resize_buffer(dev, &dev->trianglesBuffer, CL_MEM_READ_ONLY, sizeof(Triangle),
+                              old.triangles, capacity.triangles, s_uploadedTriangles) && ok;
+    ok = engine_resize_buffer(dev, &dev->verticesBuffer, CL_MEM_READ_ONLY, vertexSize,
+                              old.vertices, capacity.vertices, s_uploadedVertices) && ok;
+    ok = engine_resize_buffer(dev, &dev->pixelsBuffer, CL_MEM_READ_ONLY, sizeof(Color),
+                              old.pixels, capacity.pixels, s_uploadedPixels) && ok;
+    ok = engine_resize_buffer(dev, &dev->modelsBuffer, CL_MEM_READ_ONLY, sizeof(CustomModel),
+                              old.models, capacity.models, s_uploadedModels) && ok;
+    ok = engine_resize_buffer(dev, &dev->drawRangesBuffer, CL_MEM_READ_ONLY, sizeof(DrawRange),
+                              old.models, capacity.models, 0) && ok;
+
+    // Rebuilt every frame, nothing to carry over
+    ok = engine_resize_buffer(dev, &dev->projectedVertsBuffer, CL_MEM_READ_WRITE, sizeof(f4),
+                              old.instanceVerts, capacity.instanceVerts, 0) && ok;
+    ok = engine_resize_buffer(dev, &dev->setupMetaBuffer, CL_MEM_READ_WRITE, sizeof(TriMeta),
+                              old.instanceTris, capacity.instanceTris, 0) && ok;
+    ok = engine_resize_buffer(dev, &dev->triMetaBuffer, CL_MEM_READ_WRITE, sizeof(TriMeta),
+                              old.instanceTris, capacity.instanceTris, 0) && ok;
+    ok = engine_resize_buffer(dev, &dev->visibleFlagsBuffer, CL_MEM_READ_WRITE, sizeof(cl_int),
+                              old.instanceTris, capacity.instanceTris, 0) && ok;
+    ok = engine_resize_buffer(dev, &dev->scanOffsetsBuffer, CL_MEM_READ_WRITE, sizeof(cl_int),
+                              old.instanceTris, capacity.instanceTris, 0) && ok;
+    ok = engine_resize_buffer(dev, &dev->blockSumsBuffer, CL_MEM_READ_WRITE, sizeof(cl_int),
+                              old.scanBlocks, capacity.scanBlocks, 0) && ok;
+    if (!dev->visibleCountBuffer)
+    {
+      dev->visibleCountBuffer = clCreateBuffer(dev->context, CL_MEM_READ_WRITE, sizeof(cl_int), NULL, &s_err);
+      if (s_err != CL_SUCCESS) { printf("Error creating visible count buffer: %d\n", s_err); ok = false; }
+    }
 
-  s_projectedVertsBuffer = clCreateBuffer(s_context, CL_MEM_READ_WRITE,
-                                          sizeof(f4) * s_totalVerts, NULL, NULL);
+    engine_bind_model_buffers(dev);
+    resized = resized && ok;
+  }
+  if (!resized) return false;
+  s_capacity = capacity;
 
-  clSetKernelArg(s_vertexKernel, 4, sizeof(cl_mem), &s_projectedVertsBuffer);
-  clSetKernelArg(s_fragmentKernel, 1, sizeof(cl_mem), &s_projectedVertsBuffer);
+  // Same host arrays are uploaded into every device's context. A failed write
+  // leaves everything marked not uploaded, resending a range is harmless
+  bool written = true;
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+
+    // Streamed-in data gets its own copy, the per-frame transform span goes through staging
+    written = engine_write_owned(dev, dev->trianglesBuffer, s_uploadedTriangles * sizeof(Triangle),
+                                 s_allTriangles + s_uploadedTriangles,
+                                 (numTriangles - s_uploadedTriangles) * sizeof(Triangle)) && written;
+    written = engine_write_owned(dev, dev->verticesBuffer, s_uploadedVertices * vertexSize,
+                                 vertices + s_uploadedVertices * vertexSize,
+                                 (numVertices - s_uploadedVertices) * vertexSize) && written;
+    written = engine_write_owned(dev, dev->pixelsBuffer, s_uploadedPixels * sizeof(Color),
+                                 s_allTexturePixels + s_uploadedPixels,
+                                 (numPixels - s_uploadedPixels) * sizeof(Color)) && written;
+    written = engine_write_range(dev, dev->modelsBuffer, dirtyFirst * sizeof(CustomModel),
+                                 s_Models + dirtyFirst, (dirtyLast - dirtyFirst) * sizeof(CustomModel)) && written;
+    written = engine_write_owned(dev, dev->modelsBuffer, s_uploadedModels * sizeof(CustomModel),
+                                 s_Models + s_uploadedModels,
+                                 (numModels - s_uploadedModels) * sizeof(CustomModel)) && written;
+  }
+  if (!written) return false;
 
-  clSetKernelArg(s_vertexKernel, 0, sizeof(cl_mem), &s_trianglesBuffer);
-  clSetKernelArg(s_vertexKernel, 1, sizeof(cl_mem), &s_modelsBuffer);
-  clSetKernelArg(s_vertexKernel, 2, sizeof(int), &numModels);
-  clSetKernelArg(s_vertexKernel, 3, sizeof(int), &s_totalVerts);
+  s_uploadedTriangles = numTriangles;
+  s_uploadedVertices = numVertices;
+  s_uploadedPixels = numPixels;
+  s_uploadedModels = numModels;
+  s_dirtyFirst = INT_MAX;
+  s_dirtyLast = -1;
 
-  clSetKernelArg(s_fragmentKernel, 6, sizeof(cl_mem), &s_trianglesBuffer);
-  clSetKernelArg(s_fragmentKernel, 7, sizeof(cl_mem), &s_modelsBuffer);
-  clSetKernelArg(s_fragmentKernel, 8, sizeof(int), &numModels);
-  clSetKernelArg(s_fragmentKernel, 9, sizeof(cl_mem), &s_pixelsBuffer);
+  if ((int)numModels != s_bvhModels) engine_build_bvh();
+  return true;
 }
 
 void engine_print_model_data()
 {
     for (size_t m = 0; m < arrlen(s_Models); m++) {
         CustomModel* model = &s_Models[m];
-        printf("Model %zu:\n", m);
+        printf("Instance %zu:\n", m);
         printf("  Triangles: %d\n", model->triangleCount);
-        printf("  Texture size: %dx%d\n", model->texWidth, model->texHeight);
+        printf("  Vertices: %d\n", model->vertexCount);
+        printf("  Texture size: %dx%d, %d mip levels\n", model->texWidth, model->texHeight, model->texLevels);
         printf("  Transform matrix:\n");
         MatPrint(&model->transform); 
 
         for (int t = 0; t < model->triangleCount; t++) {
-            const Triangle* tri = &s_allTriangles[model->triangleOffset + t];
+            const Triangle* tri = &s_allTriangles[model->meshTriangleOffset + t];
             printf("  Triangle %d:\n", t);
             for (int v = 0; v < 3; v++) {
-                printf("    Vertex %d:\n", v);
+                const Vertex* vert = &s_allVertices[model->meshVertexOffset + tri->indices[v]];
+                printf("    Vertex %d (index %d):\n", v, tri->indices[v]);
                 printf("      Position: (%f, %f, %f)\n",
-                       tri->vertex[v].x,
-                       tri->vertex[v].y,
-                       tri->vertex[v].z);
+                       vert->position.x,
+                       vert->position.y,
+                       vert->position.z);
                 printf("      UV:       (%f, %f)\n",
-                       tri->uv[v].x,
-                       tri->uv[v].y);
+                       vert->uv.x,
+                       vert->uv.y);
                 printf("      Normal:   (%f, %f, %f)\n",
-                       tri->normal[v].x,
-                       tri->normal[v].y,
-                       tri->normal[v].z);
+                       vert->normal.x,
+                       vert->normal.y,
+                       vert->normal.z);
             }
         }
         printf("\n");
@@ -411,13 +3496,35 @@ void engine_print_model_data()
 
 void engine_free_all_models()
 {
+  engine_wait_loads();
+  engine_stop_loader(); // restarted by the next async load
+
   arrfree(s_allTriangles);
+  arrfree(s_allVertices);
+  arrfree(s_allPackedVertices);
   arrfree(s_allTexturePixels);
   arrfree(s_Models);
-  s_triOffset = 0;
-  s_pixOffset = 0;
+  arrfree(s_modelBounds);
+  arrfree(s_modelMeshes);
+  arrfree(s_modelLods);
+  arrfree(s_bvhNodes);
+  arrfree(s_bvhOrder);
+  arrfree(s_modelVisible);
+  arrfree(s_drawRanges);
+  s_bvhModels = 0;
+  s_bvhDirty = false;
+  s_uploadedTriangles = 0;
+  s_uploadedVertices = 0;
+  s_uploadedPixels = 0;
+  s_uploadedModels = 0;
+  s_dirtyFirst = INT_MAX;
+  s_dirtyLast = -1;
+  arrfree(s_meshes);
+  arrfree(s_textures);
+  shfree(s_meshLookup);
+  shfree(s_textureLookup);
   s_totalTriangles = 0;
-  s_totalTexturePixels = 0;
+  s_totalVerts = 0;
 }
 
 void engine_init_camera(int width, int height, float fov, float near_plane, float far_plane)
@@ -432,6 +3539,7 @@ void engine_init_camera(int width, int height, float fov, float near_plane, floa
   s_camera.fov_rad = DegToRad(s_camera.fov);  
   s_camera.proj = MatPerspective(s_camera.fov_rad, s_camera.aspect_ratio, s_camera.near_plane, s_camera.far_plane);
   s_camera.look_at = MatLookAt(s_camera.Position, f3Add(s_camera.Position, s_camera.Front), s_camera.WorldUp);
+  s_frameView = (FrameView){ s_camera.Position, s_camera.look_at };
   s_camera.yaw = 90.0f;
   s_camera.pitch = 0.0f;
   s_camera.speed = 2.0f;
@@ -441,17 +3549,27 @@ void engine_init_camera(int width, int height, float fov, float near_plane, floa
   s_camera.firstMouse = true;
   s_camera.deltaTime = 1.0/60.0f;
 
-  s_projectionBuffer  = clCreateBuffer(s_context, CL_MEM_READ_ONLY, sizeof(f4x4), NULL, &s_err);
-  s_viewBuffer  = clCreateBuffer(s_context, CL_MEM_READ_ONLY, sizeof(f4x4), NULL, &s_err);
-  s_cameraPosBuffer  = clCreateBuffer(s_context, CL_MEM_READ_ONLY, sizeof(f3), NULL, &s_err);
+  for (int d = 0; d < s_deviceCount; d++)
+  {
+    RenderDevice* dev = &s_devices[d];
+
+    dev->projectionBuffer  = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, sizeof(f4x4), NULL, &s_err);
+    dev->viewBuffer  = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, sizeof(f4x4), NULL, &s_err);
+    dev->cameraPosBuffer  = clCreateBuffer(dev->context, CL_MEM_READ_ONLY, sizeof(f3), NULL, &s_err);
 
-  clSetKernelArg(s_vertexKernel, 5, sizeof(cl_mem), &s_projectionBuffer); 
-  clSetKernelArg(s_vertexKernel, 6, sizeof(cl_mem), &s_viewBuffer); 
-  clSetKernelArg(s_vertexKernel, 7, sizeof(cl_mem), &s_cameraPosBuffer);
+    clSetKernelArg(dev->vertexKernel, 6, sizeof(cl_mem), &dev->projectionBuffer); 
+    clSetKernelArg(dev->vertexKernel, 7, sizeof(cl_mem), &dev->viewBuffer); 
+    clSetKernelArg(dev->vertexKernel, 8, sizeof(cl_mem), &dev->cameraPosBuffer);
 
-  clSetKernelArg(s_fragmentKernel, 5, sizeof(cl_mem), &s_cameraPosBuffer);
+    clSetKernelArg(dev->lightBoundsKernel, 2, sizeof(cl_mem), &dev->projectionBuffer);
+    clSetKernelArg(dev->lightBoundsKernel, 3, sizeof(cl_mem), &dev->viewBuffer);
+    clSetKernelArg(dev->clusterLightsKernel, 6, sizeof(float), &s_camera.near_plane);
+    clSetKernelArg(dev->clusterLightsKernel, 7, sizeof(float), &s_camera.far_plane);
 
-  clEnqueueWriteBuffer(s_queue, s_projectionBuffer, CL_TRUE, 0, sizeof(f4x4), &s_camera.proj, 0, NULL, NULL);
+    engine_bind_variant_args(dev);
+
+    clEnqueueWriteBuffer(dev->queue, dev->projectionBuffer, CL_TRUE, 0, sizeof(f4x4), &s_camera.proj, 0, NULL, NULL);
+  }
 }
 
 void engine_process_camera_keys(Movement direction)
@@ -502,3 +3620,16 @@ void engine_update_camera(float mouseX, float mouseY, bool constrainPitch)
 
   s_camera.look_at = MatLookAt(s_camera.Position, f3Add(s_camera.Position, s_camera.Front), s_camera.Up);
 }
+
+void engine_set_camera(f3 position, f3 target)
+{
+  s_camera.Position = position;
+  s_camera.Front = f3Norm(f3Sub(target, position));
+  s_camera.pitch = RadToDeg(asinf(fmaxf(-1.0f, fminf(1.0f, s_camera.Front.y))));
+  s_camera.yaw = RadToDeg(atan2f(s_camera.Front.z, s_camera.Front.x));
+
+  s_camera.Right = f3Norm(f3Cross(s_camera.Front, s_camera.WorldUp));
+  s_camera.Up    = f3Norm(f3Cross(s_camera.Right, s_camera.Front));
+
+  s_camera.look_at = MatLookAt(s_camera.Position, f3Add(s_camera.Position, s_camera.Front), s_camera.Up);
+}
@@ -7,12 +7,48 @@
 #include <raylib.h>
 
 typedef struct {
-    f3 vertex[3]; 
-    f3 normal[3];
-    f2 uv[3];
-    int modelIdx;
+    f3 position;
+    f3 normal;
+    f2 uv;
+} Vertex;
+
+typedef struct {
+    int indices[3]; // relative to the owning mesh's vertex offset
+    int meshIdx;
 } Triangle;
 
+// Point light, or a spot light when spotCos > -1. Lights add to the fixed
+// directional light and only reach fragments within range
+typedef struct {
+    f3 position;
+    float range;
+    f3 color;
+    float intensity;
+    f3 direction; // spot lights only, where the cone points
+    float spotCos; // cosine of the cone half-angle, -1 for point lights
+} EngineLight;
+
+typedef enum {
+    STAGE_CLEAR,
+    STAGE_VERTEX,
+    STAGE_SETUP,    // triangle setup, culling and compaction
+    STAGE_BINNING,
+    STAGE_FRAGMENT,
+    STAGE_READBACK,
+    STAGE_HOST,     // wall time spent inside engine_* frame calls
+    STAGE_COUNT
+} EngineStage;
+
+typedef struct {
+    float min, avg, p99, last; // milliseconds
+} StageStats;
+
+typedef struct {
+    StageStats stages[STAGE_COUNT];
+    int frames; // frames in the rolling window
+    size_t triangles; // submitted by the last frame, after culling
+} EngineStats;
+
 typedef enum {
     FORWARD,
     BACKWARD,
@@ -20,22 +56,59 @@ typedef enum {
     RIGHT
 } Movement;
 
+void engine_list_devices();
+void engine_select_devices(const char* selection); // "1", "NVIDIA" or "0,2" to split frames, call before init
+void engine_set_packed_vertices(bool enabled); // 12 byte quantized vertices instead of 32, call before init
+void engine_set_visibility_buffer(bool enabled); // shade each pixel once, needs 64-bit atomics, call before init
+void engine_set_native_backend(bool enabled); // rasterize on the CPU threads, also the fallback without a device, call before init
+bool engine_is_native(); // after init: frames come from the CPU threads, asked for or as the fallback
+void engine_set_mesh_lods(bool enabled); // meshes loaded afterwards get simplified levels, picked per instance by screen size
+void engine_set_dynamic_resolution(float targetMs, float minScale); // scales the render size to hold targetMs of device time (0 = off), call before init
+float engine_get_resolution_scale(); // render width over output width
 void engine_init(const char* kernel,int width, int height);
+void engine_init_headless(const char* kernel, int width, int height, cl_device_type deviceType); // no window, any device type
 void engine_background_color(Color color);
+void engine_set_lighting(bool enabled); // switches to the unlit fragment variant when off
+int engine_add_light(EngineLight light); // returns the light index
+void engine_set_light(int index, EngineLight light);
+void engine_clear_lights();
 void engine_clear_background();
 void engine_send_camera_matrix();
 void engine_run_rasterizer();
+void engine_read_frame();
 void engine_read_and_display();
+bool engine_save_frame(const char* path); // .png, anything else is raw RGBA8
+
+// Frame pipeline for windowed rendering: a submit thread culls, enqueues and waits
+// on the devices while the main thread keeps polling input and updating the scene.
+// Scene calls stay on the main thread, they are serialized against the submit thread
+void engine_pipeline_start(int depth); // at most depth submitted frames wait for the submit thread
+void engine_pipeline_submit(); // queues a frame with the current camera, blocks while depth frames are waiting
+bool engine_pipeline_present(); // draws the newest finished frame, false if it is the one shown last time
+void engine_pipeline_stop(); // renders what was queued, engine_close also stops it
 void engine_close();
 
-void engine_load_model(const char* filePath,const char* texturePath,f4x4 transform);
-void engine_upload_models_data();
+EngineStats engine_get_stats();
+void engine_print_stats();
+void engine_stats_capture(bool enabled); // starts recording every frame for the writers below
+bool engine_stats_write_csv(const char* path);
+bool engine_stats_write_trace(const char* path); // Chrome trace JSON
+
+int engine_load_mesh(const char* filePath, const char* texturePath); // imported once, repeated paths return the same mesh
+int engine_add_instance(int mesh, f4x4 transform); // returns the instance index, uploaded with the next frame
+void engine_set_model_transform(int instance, f4x4 transform); // moved instances are written once per frame
+void engine_load_model(const char* filePath,const char* texturePath,f4x4 transform); // mesh + one instance
+void engine_load_model_async(const char* filePath, const char* texturePath, f4x4 transform); // imported on the loader pool
+int engine_poll_loads(); // merges finished imports, returns how many requests are still pending
+void engine_wait_loads();
+bool engine_upload_models_data(); // sends only what changed, false while a device buffer cannot grow. engine_run_rasterizer also calls it
 void engine_print_model_data();
 void engine_free_all_models();
 void engine_init_camera(int width, int height, float fov, float near_plane, float far_plane);
 
 void engine_process_camera_keys(Movement direction);
 void engine_update_camera(float mouseX, float mouseY, bool constrainPitch);
+void engine_set_camera(f3 position, f3 target); // scripted cameras, mouse look continues from there
 
 
 
@@ -0,0 +1,96 @@
+#include "file_map.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <sys/stat.h>
+
+bool file_map_open(MappedFile* file, const char* path)
+{
+  file->data = NULL;
+  file->size = 0;
+  file->handle = NULL;
+
+  HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (f == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(f, &size) || size.QuadPart == 0) { CloseHandle(f); return false; }
+
+  HANDLE mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(f); // the mapping keeps the file open
+  if (!mapping) return false;
+
+  const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) { CloseHandle(mapping); return false; }
+
+  file->data = data;
+  file->size = (size_t)size.QuadPart;
+  file->handle = mapping;
+  return true;
+}
+
+void file_map_close(MappedFile* file)
+{
+  if (file->data) UnmapViewOfFile(file->data);
+  if (file->handle) CloseHandle((HANDLE)file->handle);
+  file->data = NULL;
+  file->size = 0;
+  file->handle = NULL;
+}
+
+bool file_stat(const char* path, uint64_t* size, int64_t* modified)
+{
+  struct _stat64 st;
+  if (_stat64(path, &st) != 0) return false;
+  *size = (uint64_t)st.st_size;
+  *modified = (int64_t)st.st_mtime;
+  return true;
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool file_map_open(MappedFile* file, const char* path)
+{
+  file->data = NULL;
+  file->size = 0;
+  file->handle = NULL;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+
+  void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping keeps the file alive
+  if (data == MAP_FAILED) return false;
+
+  file->data = data;
+  file->size = (size_t)st.st_size;
+  return true;
+}
+
+void file_map_close(MappedFile* file)
+{
+  if (file->data) munmap((void*)file->data, file->size);
+  file->data = NULL;
+  file->size = 0;
+  file->handle = NULL;
+}
+
+bool file_stat(const char* path, uint64_t* size, int64_t* modified)
+{
+  struct stat st;
+  if (stat(path, &st) != 0) return false;
+  *size = (uint64_t)st.st_size;
+  *modified = (int64_t)st.st_mtime;
+  return true;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only file mappings, kept apart from engine.c since <windows.h>
+// clashes with raylib.h
+
+typedef struct {
+    const void* data;
+    size_t size;
+    void* handle; // platform mapping handle
+} MappedFile;
+
+bool file_map_open(MappedFile* file, const char* path);
+void file_map_close(MappedFile* file);
+bool file_stat(const char* path, uint64_t* size, int64_t* modified);
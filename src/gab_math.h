@@ -42,12 +42,44 @@ f4x4 MatTransform(f3 position, f3 deg_rotation, f3 scale);
 f4x4 MatInverseRT(const f4x4* m);
 f4x4 MatLookAt(f3 position, f3 target, f3 up);
 
+// Batch functions, SSE2 on any x86-64 build of the GABMATH_IMPLEMENTATION unit,
+// AVX when that unit is built with it (GABCL_AVX2 does so for engine.c), plain
+// loops otherwise or with GABMATH_SCALAR defined.
+// Any pointer works, the aligned types below just keep loads on one cache line
+#if defined(_MSC_VER)
+#define GABMATH_ALIGN(n) __declspec(align(n))
+#else
+#define GABMATH_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+typedef struct GABMATH_ALIGN(16) f4A { float x,y,z,w; } f4A;         // layout of f4
+typedef struct GABMATH_ALIGN(32) f4x4A { float f[4][4]; } f4x4A;   // layout of f4x4
+
+// Structure of arrays, one stream per component
+typedef struct f3SoA { float* x; float* y; float* z; } f3SoA;
+typedef struct f4SoA { float* x; float* y; float* z; float* w; } f4SoA;
+
+void MatMulArray(const f4x4* a, const f4x4* b, f4x4* out, int count); // out[i] = a * b[i]
+f4x4 MatMulChain(const f4x4* mats, int count); // mats[0] * mats[1] * ... * mats[count - 1]
+f4x4 MatInverseAffine(const f4x4* m); // any invertible affine (scale, shear), MatInverseRT only undoes rotation + translation
+void MatInverseAffineArray(const f4x4* m, f4x4* out, int count);
+void MatTransformPoints(const f4x4* m, f3SoA in, f4SoA out, int count); // points with w = 1, out.w may be NULL
+
 #endif // GABMATH_H
 
 #ifdef GABMATH_IMPLEMENTATION
 #include <stdio.h>
 #include <math.h>
 
+#if !defined(GABMATH_SCALAR) && defined(__AVX__)
+#include <immintrin.h>
+#define GABMATH_AVX 1
+#define GABMATH_SSE 1
+#elif !defined(GABMATH_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define GABMATH_SSE 1
+#endif
+
 float DegToRad(float degrees)
 {
   return degrees * (3.14159265358979323846f / 180.0f);
@@ -276,4 +308,115 @@ f4x4 MatLookAt(f3 position, f3 target, f3 up)
 
   return mat;
 }
+
+// out = a * b for row-major f4x4, row r of out is a's row r weighting b's rows
+static inline void MatMulInto(const f4x4* a, const f4x4* b, f4x4* out)
+{
+#if defined(GABMATH_SSE)
+  __m128 b0 = _mm_loadu_ps(b->f[0]);
+  __m128 b1 = _mm_loadu_ps(b->f[1]);
+  __m128 b2 = _mm_loadu_ps(b->f[2]);
+  __m128 b3 = _mm_loadu_ps(b->f[3]);
+  for (int r = 0; r < 4; r++)
+  {
+    __m128 row = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a->f[r][0]), b0), _mm_mul_ps(_mm_set1_ps(a->f[r][1]), b1)),
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a->f[r][2]), b2), _mm_mul_ps(_mm_set1_ps(a->f[r][3]), b3)));
+    _mm_storeu_ps(out->f[r], row);
+  }
+#else
+  *out = MatMul(*a, *b);
+#endif
+}
+void MatMulArray(const f4x4* a, const f4x4* b, f4x4* out, int count)
+{
+  f4x4 left = *a; // out may alias a
+  for (int i = 0; i < count; i++)
+    MatMulInto(&left, &b[i], &out[i]);
+}
+f4x4 MatMulChain(const f4x4* mats, int count)
+{
+  if (count <= 0) return MatIdentity();
+
+  f4x4 result = mats[0];
+  for (int i = 1; i < count; i++)
+  {
+    f4x4 left = result;
+    MatMulInto(&left, &mats[i], &result);
+  }
+  return result;
+}
+f4x4 MatInverseAffine(const f4x4* m)
+{
+  f4x4 inv = {0};
+
+  // inverse of the upper 3x3 from its cofactors
+  float c00 = m->f[1][1] * m->f[2][2] - m->f[1][2] * m->f[2][1];
+  float c01 = m->f[1][2] * m->f[2][0] - m->f[1][0] * m->f[2][2];
+  float c02 = m->f[1][0] * m->f[2][1] - m->f[1][1] * m->f[2][0];
+  float det = m->f[0][0] * c00 + m->f[0][1] * c01 + m->f[0][2] * c02;
+  float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+  inv.f[0][0] = c00 * invDet;
+  inv.f[1][0] = c01 * invDet;
+  inv.f[2][0] = c02 * invDet;
+  inv.f[0][1] = (m->f[0][2] * m->f[2][1] - m->f[0][1] * m->f[2][2]) * invDet;
+  inv.f[1][1] = (m->f[0][0] * m->f[2][2] - m->f[0][2] * m->f[2][0]) * invDet;
+  inv.f[2][1] = (m->f[0][1] * m->f[2][0] - m->f[0][0] * m->f[2][1]) * invDet;
+  inv.f[0][2] = (m->f[0][1] * m->f[1][2] - m->f[0][2] * m->f[1][1]) * invDet;
+  inv.f[1][2] = (m->f[0][2] * m->f[1][0] - m->f[0][0] * m->f[1][2]) * invDet;
+  inv.f[2][2] = (m->f[0][0] * m->f[1][1] - m->f[0][1] * m->f[1][0]) * invDet;
+
+  // inverse translation
+  inv.f[0][3] = -(inv.f[0][0] * m->f[0][3] + inv.f[0][1] * m->f[1][3] + inv.f[0][2] * m->f[2][3]);
+  inv.f[1][3] = -(inv.f[1][0] * m->f[0][3] + inv.f[1][1] * m->f[1][3] + inv.f[1][2] * m->f[2][3]);
+  inv.f[2][3] = -(inv.f[2][0] * m->f[0][3] + inv.f[2][1] * m->f[1][3] + inv.f[2][2] * m->f[2][3]);
+
+  inv.f[3][3] = 1.0f;
+  return inv;
+}
+void MatInverseAffineArray(const f4x4* m, f4x4* out, int count)
+{
+  for (int i = 0; i < count; i++)
+    out[i] = MatInverseAffine(&m[i]);
+}
+void MatTransformPoints(const f4x4* m, f3SoA in, f4SoA out, int count)
+{
+  int i = 0;
+#if defined(GABMATH_AVX)
+  for (; i + 8 <= count; i += 8)
+  {
+    __m256 x = _mm256_loadu_ps(in.x + i), y = _mm256_loadu_ps(in.y + i), z = _mm256_loadu_ps(in.z + i);
+    for (int r = 0; r < 4; r++)
+    {
+      float* dst = r == 0 ? out.x : r == 1 ? out.y : r == 2 ? out.z : out.w;
+      if (!dst) continue;
+      __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m->f[r][0]), x), _mm256_mul_ps(_mm256_set1_ps(m->f[r][1]), y)),
+                               _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m->f[r][2]), z), _mm256_set1_ps(m->f[r][3])));
+      _mm256_storeu_ps(dst + i, v);
+    }
+  }
+#endif
+#if defined(GABMATH_SSE)
+  for (; i + 4 <= count; i += 4)
+  {
+    __m128 x = _mm_loadu_ps(in.x + i), y = _mm_loadu_ps(in.y + i), z = _mm_loadu_ps(in.z + i);
+    for (int r = 0; r < 4; r++)
+    {
+      float* dst = r == 0 ? out.x : r == 1 ? out.y : r == 2 ? out.z : out.w;
+      if (!dst) continue;
+      __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m->f[r][0]), x), _mm_mul_ps(_mm_set1_ps(m->f[r][1]), y)),
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m->f[r][2]), z), _mm_set1_ps(m->f[r][3])));
+      _mm_storeu_ps(dst + i, v);
+    }
+  }
+#endif
+  for (; i < count; i++)
+  {
+    float x = in.x[i], y = in.y[i], z = in.z[i];
+    out.x[i] = m->f[0][0] * x + m->f[0][1] * y + m->f[0][2] * z + m->f[0][3];
+    out.y[i] = m->f[1][0] * x + m->f[1][1] * y + m->f[1][2] * z + m->f[1][3];
+    out.z[i] = m->f[2][0] * x + m->f[2][1] * y + m->f[2][2] * z + m->f[2][3];
+    if (out.w) out.w[i] = m->f[3][0] * x + m->f[3][1] * y + m->f[3][2] * z + m->f[3][3];
+  }
+}
 #endif // MYLIB_IMPLEMENTATION
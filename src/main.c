@@ -1,26 +1,125 @@
 #include "engine.h"
 #include "raylib.h"
 
-int main()
+#include <string.h>
+
+typedef struct {
+  bool headless;
+  bool lighting;
+  bool pipeline;
+  cl_device_type deviceType;
+  int width;
+  int height;
+  int frames;
+  const char* output;
+  const char* statsPath;
+  const char* tracePath;
+} Options;
+
+static Options parse_options(int argc, char** argv)
+{
+  Options opt = { false, true, true, CL_DEVICE_TYPE_GPU, 800, 600, 1, "frame", NULL, NULL };
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--headless") == 0) opt.headless = true;
+    else if (strcmp(argv[i], "--no-lighting") == 0) opt.lighting = false;
+    else if (strcmp(argv[i], "--no-pipeline") == 0) opt.pipeline = false;
+    else if (strcmp(argv[i], "--cpu") == 0) opt.deviceType = CL_DEVICE_TYPE_CPU;
+    else if (strcmp(argv[i], "--any-device") == 0) opt.deviceType = CL_DEVICE_TYPE_ALL;
+    else if (strcmp(argv[i], "--list-devices") == 0) { engine_list_devices(); exit(0); }
+    else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) engine_select_devices(argv[++i]);
+    else if (strcmp(argv[i], "--packed-vertices") == 0) engine_set_packed_vertices(true);
+    else if (strcmp(argv[i], "--visibility-buffer") == 0) engine_set_visibility_buffer(true);
+    else if (strcmp(argv[i], "--native") == 0) engine_set_native_backend(true);
+    else if (strcmp(argv[i], "--lods") == 0) engine_set_mesh_lods(true);
+    else if (strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc) engine_set_dynamic_resolution((float)atof(argv[++i]), 0.5f);
+    else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) opt.width = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) opt.height = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) opt.frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) opt.output = argv[++i];
+    else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) opt.statsPath = argv[++i];
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) opt.tracePath = argv[++i];
+    else printf("Unknown option: %s\n", argv[i]);
+  }
+
+  return opt;
+}
+
+static void load_scene()
+{
+  engine_load_model_async("res/rayman_2_mdl.obj","res/Rayman.png",MatTransform((f3){1.0f, 0.0f, 3.0f},(f3){0.0f, 180.0f, 0.0f},(f3){0.1f, 0.1f, 0.1f}));
+  /*CustomModel model2 = {0};*/
+  /*engine_load_model(&model2, "res/bunny.obj",NULL,(Color){0,255,0,255},MatTransform((f3){1.0f, 0.0f, 3.0f},(f3){0.0f, 180.0f, 0.0f},(f3){1.1f, 1.1f, 1.1f}));*/
+
+  engine_wait_loads();
+  engine_upload_models_data();
+}
+
+static void write_stats(Options opt)
+{
+  engine_print_stats();
+  if (opt.statsPath) engine_stats_write_csv(opt.statsPath);
+  if (opt.tracePath) engine_stats_write_trace(opt.tracePath);
+}
+
+// Renders opt.frames frames without a window and writes each one to disk,
+// "<out>_0000.png" style, or ".raw" RGBA8 dumps when --out ends in .raw
+static int run_headless(Options opt)
+{
+  engine_init_headless("src/shapes.cl", opt.width, opt.height, opt.deviceType);
+  engine_background_color((Color){0,0,0,255});
+  engine_set_lighting(opt.lighting);
+
+  engine_init_camera(opt.width, opt.height, 90.0f, 0.01f, 1000.0f);
+  load_scene();
+  engine_stats_capture(opt.statsPath || opt.tracePath);
+
+  const char* ext = strrchr(opt.output, '.');
+  bool raw = ext && strcmp(ext, ".raw") == 0;
+  int stemLength = raw ? (int)(ext - opt.output) : (int)strlen(opt.output);
+
+  char path[512];
+  for (int frame = 0; frame < opt.frames; frame++)
+  {
+    engine_clear_background();
+    engine_send_camera_matrix();
+    engine_run_rasterizer();
+    engine_read_frame();
+
+    snprintf(path, sizeof(path), "%.*s_%04d%s", stemLength, opt.output, frame, raw ? ".raw" : ".png");
+    if (!engine_save_frame(path)) printf("Failed to write %s\n", path);
+  }
+
+  write_stats(opt);
+  engine_free_all_models();
+  engine_close();
+
+  return 0;
+}
+
+int main(int argc, char** argv)
 {
-  InitWindow(800, 600, "GABCL");
+  Options opt = parse_options(argc, argv);
+  if (opt.headless) return run_headless(opt);
+
+  InitWindow(opt.width, opt.height, "GABCL");
   SetTargetFPS(60);
   DisableCursor();
 
   engine_init("src/shapes.cl",GetScreenWidth(),GetScreenHeight());
   engine_background_color((Color){0,0,0,255});
+  engine_set_lighting(opt.lighting);
 
   engine_init_camera(GetScreenWidth(),GetScreenHeight(),90.0f,0.01f,1000.0f);
 
-  engine_load_model("res/rayman_2_mdl.obj","res/Rayman.png",MatTransform((f3){1.0f, 0.0f, 3.0f},(f3){0.0f, 180.0f, 0.0f},(f3){0.1f, 0.1f, 0.1f}));
-  /*CustomModel model2 = {0};*/
-  /*engine_load_model(&model2, "res/bunny.obj",NULL,(Color){0,255,0,255},MatTransform((f3){1.0f, 0.0f, 3.0f},(f3){0.0f, 180.0f, 0.0f},(f3){1.1f, 1.1f, 1.1f}));*/
-
-  engine_upload_models_data();
+  load_scene();
+  engine_stats_capture(opt.statsPath || opt.tracePath);
+  if (opt.pipeline) engine_pipeline_start(2);
 
   while (!WindowShouldClose())
   {
-    engine_clear_background();
+    if (!opt.pipeline) engine_clear_background();
 
     if (IsKeyDown(KEY_W)) engine_process_camera_keys(FORWARD);
     if (IsKeyDown(KEY_S)) engine_process_camera_keys(BACKWARD);
@@ -28,16 +127,25 @@ int main()
     if (IsKeyDown(KEY_D)) engine_process_camera_keys(RIGHT);
 
     engine_update_camera(GetMouseX(), GetMouseY(), true);
-    engine_send_camera_matrix();
 
-    engine_run_rasterizer();
-    engine_read_and_display();
+    if (opt.pipeline)
+    {
+      engine_pipeline_submit();
+      engine_pipeline_present();
+    }
+    else
+    {
+      engine_send_camera_matrix();
+      engine_run_rasterizer();
+      engine_read_and_display();
+    }
     printf("%d\n",GetFPS());
   }
 
+  engine_pipeline_stop();
+  write_stats(opt);
   engine_free_all_models();
   engine_close();
 
   return 0;
 }
-
@@ -0,0 +1,320 @@
+#include "mesh_lod.h"
+#include "stb_ds.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#define LOD_MIN_TRIANGLES 64 // no level is built below this
+#define LOD_MIN_SAVING 0.9f  // stop once a level keeps more than this of the one before
+#define LOD_MIN_COS 0.25f    // collapses may turn a face normal by at most ~75 degrees
+
+// Sum of area weighted plane quadrics, a*x*x + 2*b*x*y + ... packed symmetric
+typedef struct {
+    double xx, xy, xz, xw;
+    double yy, yz, yw;
+    double zz, zw;
+    double ww;
+} Quadric;
+
+// Candidate collapse of vertex from onto vertex to, which keeps its attributes
+typedef struct {
+    float cost;
+    int from;
+    int to;
+} Collapse;
+
+typedef struct {
+    float x, y, z;
+    int index;
+} SortedPosition;
+
+static void mesh_lod_add_plane(Quadric* q, double a, double b, double c, double d, double weight)
+{
+  q->xx += weight * a * a; q->xy += weight * a * b; q->xz += weight * a * c; q->xw += weight * a * d;
+  q->yy += weight * b * b; q->yz += weight * b * c; q->yw += weight * b * d;
+  q->zz += weight * c * c; q->zw += weight * c * d;
+  q->ww += weight * d * d;
+}
+
+static void mesh_lod_add(Quadric* dst, const Quadric* src)
+{
+  double* d = (double*)dst;
+  const double* s = (const double*)src;
+  for (int i = 0; i < 10; i++) d[i] += s[i];
+}
+
+// Weighted squared distance of p to the planes summed in q
+static double mesh_lod_error(const Quadric* q, f3 p)
+{
+  double x = p.x, y = p.y, z = p.z;
+  double e = q->xx * x * x + q->yy * y * y + q->zz * z * z + q->ww
+           + 2.0 * (q->xy * x * y + q->xz * x * z + q->yz * y * z)
+           + 2.0 * (q->xw * x + q->yw * y + q->zw * z);
+  return e > 0.0 ? e : 0.0;
+}
+
+static f3 mesh_lod_normal(f3 a, f3 b, f3 c)
+{
+  f3 e0 = { b.x - a.x, b.y - a.y, b.z - a.z };
+  f3 e1 = { c.x - a.x, c.y - a.y, c.z - a.z };
+  return (f3){ e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z, e0.x * e1.y - e0.y * e1.x };
+}
+
+static int mesh_lod_compare_edges(const void* a, const void* b)
+{
+  uint64_t ea = *(const uint64_t*)a, eb = *(const uint64_t*)b;
+  return (ea > eb) - (ea < eb);
+}
+
+static int mesh_lod_compare_collapses(const void* a, const void* b)
+{
+  float ca = ((const Collapse*)a)->cost, cb = ((const Collapse*)b)->cost;
+  return (ca > cb) - (ca < cb);
+}
+
+static int mesh_lod_compare_positions(const void* a, const void* b)
+{
+  const SortedPosition* pa = (const SortedPosition*)a;
+  const SortedPosition* pb = (const SortedPosition*)b;
+  if (pa->x != pb->x) return pa->x < pb->x ? -1 : 1;
+  if (pa->y != pb->y) return pa->y < pb->y ? -1 : 1;
+  if (pa->z != pb->z) return pa->z < pb->z ? -1 : 1;
+  return 0;
+}
+
+// Vertices sharing a position with another one sit on a uv or normal seam,
+// collapsing them would tear the surface open, so they never move
+static void mesh_lod_lock_seams(const f3* positions, int numVertices, unsigned char* locked)
+{
+  SortedPosition* sorted = (SortedPosition*)malloc(numVertices * sizeof(SortedPosition));
+  for (int v = 0; v < numVertices; v++)
+    sorted[v] = (SortedPosition){ positions[v].x, positions[v].y, positions[v].z, v };
+  qsort(sorted, numVertices, sizeof(SortedPosition), mesh_lod_compare_positions);
+
+  for (int first = 0; first < numVertices;)
+  {
+    int last = first + 1;
+    while (last < numVertices && mesh_lod_compare_positions(&sorted[first], &sorted[last]) == 0) last++;
+    if (last - first > 1)
+      for (int i = first; i < last; i++) locked[sorted[i].index] = 1;
+    first = last;
+  }
+  free(sorted);
+}
+
+// Collapses edges in cheapest-first passes until count <= target or a pass
+// finds nothing to do. Each pass only touches disjoint neighbourhoods, so the
+// adjacency it starts from stays valid for every collapse it accepts
+static int mesh_lod_simplify(const f3* positions, int numVertices, Quadric* quadrics,
+                             const unsigned char* seams, int* indices, int count, int target)
+{
+  unsigned char* locked = (unsigned char*)malloc(numVertices);
+  unsigned char* touched = (unsigned char*)malloc(numVertices);
+  int* remap = (int*)malloc(numVertices * sizeof(int));
+  int* adjacencyStart = (int*)malloc((numVertices + 1) * sizeof(int));
+  int* adjacency = NULL;
+  uint64_t* edges = NULL;
+  Collapse* collapses = NULL;
+
+  while (count > target)
+  {
+    // Edges used once are borders, more than twice non-manifold, both stay put
+    arrsetlen(edges, (size_t)count * 3);
+    for (int t = 0; t < count; t++)
+      for (int e = 0; e < 3; e++)
+      {
+        uint64_t a = (uint32_t)indices[t * 3 + e], b = (uint32_t)indices[t * 3 + (e + 1) % 3];
+        edges[t * 3 + e] = a < b ? (a << 32) | b : (b << 32) | a;
+      }
+    qsort(edges, (size_t)count * 3, sizeof(uint64_t), mesh_lod_compare_edges);
+
+    // Every interior edge is shared by two of the 3 * count triangle edges
+    memcpy(locked, seams, numVertices);
+    arrsetlen(collapses, (size_t)count * 3 / 2);
+    int numEdges = 0;
+    for (int first = 0; first < count * 3;)
+    {
+      int last = first + 1;
+      while (last < count * 3 && edges[last] == edges[first]) last++;
+      int a = (int)(edges[first] >> 32), b = (int)(edges[first] & 0xffffffffu);
+      if (last - first != 2) locked[a] = locked[b] = 1;
+      else collapses[numEdges++] = (Collapse){ 0.0f, a, b };
+      first = last;
+    }
+
+    // Cheaper direction of every interior edge, both ends keep their own attributes
+    int numCollapses = 0;
+    for (int i = 0; i < numEdges; i++)
+    {
+      int a = collapses[i].from, b = collapses[i].to;
+      if (locked[a] && locked[b]) continue;
+
+      Quadric q = quadrics[a];
+      mesh_lod_add(&q, &quadrics[b]);
+      double toB = locked[a] ? INFINITY : mesh_lod_error(&q, positions[b]);
+      double toA = locked[b] ? INFINITY : mesh_lod_error(&q, positions[a]);
+      collapses[numCollapses++] = toB <= toA ? (Collapse){ (float)toB, a, b } : (Collapse){ (float)toA, b, a };
+    }
+    qsort(collapses, numCollapses, sizeof(Collapse), mesh_lod_compare_collapses);
+
+    // Triangles around every vertex
+    memset(adjacencyStart, 0, (numVertices + 1) * sizeof(int));
+    for (int i = 0; i < count * 3; i++) adjacencyStart[indices[i] + 1]++;
+    for (int v = 0; v < numVertices; v++) adjacencyStart[v + 1] += adjacencyStart[v];
+    arrsetlen(adjacency, (size_t)count * 3);
+    for (int t = 0; t < count; t++)
+      for (int e = 0; e < 3; e++)
+      {
+        int v = indices[t * 3 + e];
+        adjacency[adjacencyStart[v]++] = t;
+      }
+    for (int v = numVertices; v > 0; v--) adjacencyStart[v] = adjacencyStart[v - 1];
+    adjacencyStart[0] = 0;
+
+    memset(touched, 0, numVertices);
+    for (int v = 0; v < numVertices; v++) remap[v] = v;
+
+    int remaining = count;
+    int collapsed = 0;
+    for (int i = 0; i < numCollapses && remaining > target; i++)
+    {
+      int from = collapses[i].from, to = collapses[i].to;
+      if (touched[from] || touched[to]) continue;
+
+      // Reject collapses that fold a surviving face over
+      bool valid = true;
+      int removed = 0;
+      for (int k = adjacencyStart[from]; k < adjacencyStart[from + 1] && valid; k++)
+      {
+        const int* tri = &indices[adjacency[k] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) { removed++; continue; }
+
+        f3 p[3], moved[3];
+        for (int e = 0; e < 3; e++)
+        {
+          p[e] = positions[tri[e]];
+          moved[e] = tri[e] == from ? positions[to] : p[e];
+        }
+        f3 before = mesh_lod_normal(p[0], p[1], p[2]);
+        f3 after = mesh_lod_normal(moved[0], moved[1], moved[2]);
+        float dot = before.x * after.x + before.y * after.y + before.z * after.z;
+        float lengths = sqrtf((before.x * before.x + before.y * before.y + before.z * before.z) *
+                              (after.x * after.x + after.y * after.y + after.z * after.z));
+        if (dot < LOD_MIN_COS * lengths) valid = false;
+      }
+      if (!valid) continue;
+
+      for (int k = adjacencyStart[from]; k < adjacencyStart[from + 1]; k++)
+        for (int e = 0; e < 3; e++) touched[indices[adjacency[k] * 3 + e]] = 1;
+      touched[to] = 1;
+
+      remap[from] = to;
+      mesh_lod_add(&quadrics[to], &quadrics[from]);
+      remaining -= removed;
+      collapsed++;
+    }
+    if (collapsed == 0) break;
+
+    // Apply the pass and drop the triangles that lost an edge
+    int kept = 0;
+    for (int t = 0; t < count; t++)
+    {
+      int a = remap[indices[t * 3]], b = remap[indices[t * 3 + 1]], c = remap[indices[t * 3 + 2]];
+      if (a == b || b == c || a == c) continue;
+      indices[kept * 3] = a;
+      indices[kept * 3 + 1] = b;
+      indices[kept * 3 + 2] = c;
+      kept++;
+    }
+    count = kept;
+  }
+
+  arrfree(edges);
+  arrfree(collapses);
+  arrfree(adjacency);
+  free(adjacencyStart);
+  free(remap);
+  free(touched);
+  free(locked);
+  return count;
+}
+
+int mesh_build_lods(Vertex** vertices, Triangle** triangles, MeshLod lods[MESH_LOD_MAX])
+{
+  const MeshLod base = lods[0];
+  int numVertices = base.vertexCount;
+  int count = base.triangleCount;
+  if (count < LOD_MIN_TRIANGLES * 2 || numVertices <= 0) return 1;
+
+  // Positions are copied out, appending the levels may move the vertex array
+  f3* positions = (f3*)malloc(numVertices * sizeof(f3));
+  for (int v = 0; v < numVertices; v++) positions[v] = (*vertices)[base.vertexOffset + v].position;
+
+  int* indices = (int*)malloc((size_t)count * 3 * sizeof(int));
+  for (int t = 0; t < count; t++)
+    memcpy(&indices[t * 3], (*triangles)[base.triangleOffset + t].indices, 3 * sizeof(int));
+
+  // Face quadrics weighted by area, every collapse folds its source into the target
+  Quadric* quadrics = (Quadric*)calloc(numVertices, sizeof(Quadric));
+  for (int t = 0; t < count; t++)
+  {
+    f3 p0 = positions[indices[t * 3]], p1 = positions[indices[t * 3 + 1]], p2 = positions[indices[t * 3 + 2]];
+    f3 n = mesh_lod_normal(p0, p1, p2);
+    double length = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+    if (length <= 0.0) continue;
+    double a = n.x / length, b = n.y / length, c = n.z / length;
+    double d = -(a * p0.x + b * p0.y + c * p0.z);
+    for (int e = 0; e < 3; e++)
+      mesh_lod_add_plane(&quadrics[indices[t * 3 + e]], a, b, c, d, length * 0.5);
+  }
+
+  unsigned char* seams = (unsigned char*)calloc(numVertices, 1);
+  mesh_lod_lock_seams(positions, numVertices, seams);
+
+  int* localIndex = (int*)malloc(numVertices * sizeof(int));
+  int levels = 1;
+  while (levels < MESH_LOD_MAX)
+  {
+    int target = count / 2;
+    if (target < LOD_MIN_TRIANGLES) break;
+
+    int simplified = mesh_lod_simplify(positions, numVertices, quadrics, seams, indices, count, target);
+    if (simplified > (int)(count * LOD_MIN_SAVING)) break;
+    count = simplified;
+
+    // Every level gets a compact vertex range in first-use order
+    MeshLod* lod = &lods[levels++];
+    lod->triangleOffset = (int)arrlen(*triangles);
+    lod->triangleCount = count;
+    lod->vertexOffset = (int)arrlen(*vertices);
+    lod->vertexCount = 0;
+
+    memset(localIndex, 0xff, numVertices * sizeof(int));
+    Triangle* dst = arraddnptr(*triangles, count);
+    for (int t = 0; t < count; t++)
+    {
+      dst[t].meshIdx = 0;
+      for (int e = 0; e < 3; e++)
+      {
+        int v = indices[t * 3 + e];
+        if (localIndex[v] < 0)
+        {
+          Vertex vert = (*vertices)[base.vertexOffset + v];
+          localIndex[v] = lod->vertexCount++;
+          arrpush(*vertices, vert);
+        }
+        dst[t].indices[e] = localIndex[v];
+      }
+    }
+  }
+
+  free(localIndex);
+  free(seams);
+  free(quadrics);
+  free(indices);
+  free(positions);
+  return levels;
+}
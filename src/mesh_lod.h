@@ -0,0 +1,23 @@
+#pragma once
+
+#include "engine.h"
+
+// Quadric edge-collapse simplification, engine.c builds each mesh's LOD chain
+// with it at import time
+
+#define MESH_LOD_MAX 4
+
+// One level of a mesh, offsets index the arrays the chain was built into.
+// Triangle indices of a level are relative to its own vertexOffset
+typedef struct {
+    int triangleOffset;
+    int triangleCount;
+    int vertexOffset;
+    int vertexCount;
+} MeshLod;
+
+// Appends simplified levels after the input of stb_ds arrays vertices and
+// triangles, each about half the triangles of the one before. lods[0] must
+// describe the input, the rest is filled. Returns the level count, 1 when the
+// mesh is too small or would not simplify further
+int mesh_build_lods(Vertex** vertices, Triangle** triangles, MeshLod lods[MESH_LOD_MAX]);
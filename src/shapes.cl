@@ -1,3 +1,58 @@
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
+#ifndef TILE_MAX_TRIS
+#define TILE_MAX_TRIS 1024
+#endif
+#ifndef SCAN_BLOCK
+#define SCAN_BLOCK 256
+#endif
+#ifndef HIZ_GROUP
+#define HIZ_GROUP 4
+#endif
+
+// Specialization knobs, the engine builds one fragment variant per combination
+#ifndef TEXTURE_MODE
+#define TEXTURE_MODE 0 // 0: checked per model, 1: every model textured, 2: no model textured
+#endif
+#ifndef LIGHTING
+#define LIGHTING 1
+#endif
+#ifndef TEXTURE_FILTER
+#define TEXTURE_FILTER 2 // 0: nearest on the base level, 1: bilinear, 2: trilinear
+#endif
+#ifndef PACKED_VERTICES
+#define PACKED_VERTICES 0 // 1: vertices are PackedVertex in engine.c
+#endif
+
+// Texture levels are stored as TEX_BLOCK x TEX_BLOCK blocks in row-major
+// block order, texels inside a block in Morton order, must match engine.c
+#define TEX_BLOCK 8
+#ifndef LIGHT_DIR
+#define LIGHT_DIR (float3)(5.0f, 5.0f, 0.0f)
+#endif
+
+// Light clusters are CLUSTER_TILE pixel squares split into CLUSTER_SLICES
+// exponential view depth slices, stored ((cy * clustersX + cx) * CLUSTER_SLICES + slice)
+#ifndef CLUSTER_TILE
+#define CLUSTER_TILE 64
+#endif
+#ifndef CLUSTER_SLICES
+#define CLUSTER_SLICES 16
+#endif
+#ifndef CLUSTER_MAX_LIGHTS
+#define CLUSTER_MAX_LIGHTS 64
+#endif
+
+// With SCREEN_WIDTH/SCREEN_HEIGHT defined the size arguments become constants
+#ifdef SCREEN_WIDTH
+#define FIXED_RESOLUTION(w, h) (w) = SCREEN_WIDTH; (h) = SCREEN_HEIGHT
+#define FIXED_WIDTH(w) (w) = SCREEN_WIDTH
+#else
+#define FIXED_RESOLUTION(w, h)
+#define FIXED_WIDTH(w)
+#endif
+
 typedef struct { uchar r, g, b, a; } Pixel;
 typedef struct { float x, y; } Vec2;
 typedef struct { float x, y, z; } Vec3;
@@ -9,42 +64,163 @@ typedef struct Mat4 {
     float w0, w1, w2, w3;
 } Mat4;
 
+#if PACKED_VERTICES
 typedef struct {
-    Vec3 vertex[3];
-    Vec3 normal[3];
-    Vec2 uv[3];
-    int modelIdx;
+    ushort position[3]; // quantized over the mesh bounds, see CustomModel
+    ushort normal;      // octahedral, snorm8 x and y
+    ushort uv[2];       // half floats
+} Vertex;
+#else
+typedef struct {
+    Vec3 position;
+    Vec3 normal;
+    Vec2 uv;
+} Vertex;
+#endif
+
+typedef struct {
+    int indices[3]; // relative to the owning mesh's vertex offset
+    int meshIdx;
 } Triangle;
 
+// One instance of a mesh, see CustomModel in engine.c
 typedef struct {
-    int triangleOffset;
     int triangleCount;
-    int vertexOffset;
     int vertexCount;
+    int meshTriangleOffset;
+    int meshVertexOffset;
     int pixelOffset;
     int texWidth;
     int texHeight;
+    int texLevels;
+    Vec3 quantMin;
+    Vec3 quantScale;
     Mat4 transform;
 } CustomModel;
 
+// A visible instance this frame, offsets into the per-frame streams, see DrawRange in engine.c
+typedef struct {
+    int model;
+    int vertexOffset;
+    int triangleOffset;
+} DrawRange;
+
+// See EngineLight in engine.h
+typedef struct {
+    Vec3 position;
+    float range;
+    Vec3 color;
+    float intensity;
+    Vec3 direction;
+    float spotCos; // -1 for point lights
+} Light;
+
+// Screen rectangle and view depth range a light can reach
+typedef struct {
+    float minX, minY, maxX, maxY;
+    float minDepth, maxDepth;
+} LightBounds;
+
+typedef struct {
+    int triIndex;
+    int minX, maxX, minY, maxY; // bbox inclusive (in pixel coords)
+    Vec2 v0; Vec2 v1; Vec2 v2;
+    float z0, z1, z2;
+    float w0, w1, w2;
+    float zMin, zMax; // range of the rasterized depth over the triangle
+    float invArea;
+    int modelIndex; // instance
+    int vertexOffset; // mesh vertex offset
+    int texOffset;
+    int texW;
+    int texH;
+    int texLevels;
+} TriMeta;
+
+// Attribute fetch for either vertex layout, packed ones are decoded inline
+inline float3 vertex_position(__global const Vertex* v, __global const CustomModel* model)
+{
+#if PACKED_VERTICES
+    return (float3)(model->quantMin.x + (float)v->position[0] * model->quantScale.x,
+                    model->quantMin.y + (float)v->position[1] * model->quantScale.y,
+                    model->quantMin.z + (float)v->position[2] * model->quantScale.z);
+#else
+    return (float3)(v->position.x, v->position.y, v->position.z);
+#endif
+}
+
+inline float3 vertex_normal(__global const Vertex* v)
+{
+#if PACKED_VERTICES
+    float2 e = (float2)((char)(v->normal & 0xff), (char)(v->normal >> 8)) / 127.0f;
+    float3 n = (float3)(e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y));
+    float t = fmax(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+#else
+    return (float3)(v->normal.x, v->normal.y, v->normal.z);
+#endif
+}
+
+inline float2 vertex_uv(__global const Vertex* v)
+{
+#if PACKED_VERTICES
+    return vload_half2(0, (__global const half*)v->uv);
+#else
+    return (float2)(v->uv.x, v->uv.y);
+#endif
+}
+
+// visibility is NULL unless the engine runs in visibility-buffer mode
 __kernel void clear_buffers(
     __global Pixel* pixels,
     __global float* depth,
     int width, int height,
-    Pixel color)
+    Pixel color,
+    __global ulong* visibility)
 {
+    FIXED_RESOLUTION(width, height);
     int x = get_global_id(0);
     int y = get_global_id(1);
     if (x >= width || y >= height) return;
     int idx = y * width + x;
     pixels[idx] = color;
     depth[idx] = FLT_MAX;
+    if (visibility) visibility[idx] = ULONG_MAX;
+}
+
+// Visible instances are laid out back to back, these find the draw range
+// owning an element of the per-frame vertex or triangle stream
+inline int find_range(__global const DrawRange* ranges, int numRanges, int vertex)
+{
+    int lo = 0, hi = numRanges - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (ranges[mid].vertexOffset <= vertex) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+inline int find_range_by_triangle(__global const DrawRange* ranges, int numRanges, int triangle)
+{
+    int lo = 0, hi = numRanges - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (ranges[mid].triangleOffset <= triangle) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
 }
 
 __kernel void vertex_kernel(
-    __global Triangle* tris,
+    __global Vertex* verts,
     __global CustomModel* models,
-    int numModels,
+    __global DrawRange* ranges,
+    int numRanges,
     int totalVerts,
     __global float4* projVerts,
     __global Mat4* projection,
@@ -53,21 +229,15 @@ __kernel void vertex_kernel(
     int width,
     int height)
 {
+  FIXED_RESOLUTION(width, height);
   int i = get_global_id(0);
   if (i >= totalVerts) return;
 
-  int triIdx = i / 3;
-  int vertIdx = i % 3;
+  __global const DrawRange* range = &ranges[find_range(ranges, numRanges, i)];
+  __global const CustomModel* model = &models[range->model];
+  __global const Vertex* src = &verts[model->meshVertexOffset + (i - range->vertexOffset)];
 
-  __global const Triangle* tri = &tris[triIdx];
-  __global const CustomModel* model = &models[tri->modelIdx];
-
-  float4 vert = (float4)(
-      tri->vertex[vertIdx].x,
-      tri->vertex[vertIdx].y,
-      tri->vertex[vertIdx].z,
-      1.0f
-  );
+  float4 vert = (float4)(vertex_position(src, model), 1.0f);
 
   Mat4 transform2 = model->transform;
   float4 v_model;
@@ -102,120 +272,807 @@ __kernel void vertex_kernel(
   projVerts[i] = (float4)(sx, sy, sz, v_clip.w);
 }
 
+__kernel void clear_tiles(__global int* tileCounts, __global int* tileDepth, int numTiles)
+{
+    int i = get_global_id(0);
+    if (i >= numTiles) return;
+    tileCounts[i] = 0;
+    tileDepth[i] = INT_MAX;
+}
+
+// One work-item per triangle: frustum, back-face and zero-area culling plus
+// the edge-function setup every covered pixel used to recompute on its own.
+__kernel void setup_kernel(
+    __global float4* projVerts,
+    __global Triangle* tris,
+    __global CustomModel* models,
+    __global DrawRange* ranges,
+    int numRanges,
+    int totalTriangles,
+    __global TriMeta* setupMeta,
+    __global int* visibleFlags,
+    int width,
+    int rowStart,
+    int rowEnd)
+{
+    FIXED_WIDTH(width);
+    int triIdx = get_global_id(0);
+    if (triIdx >= totalTriangles) return;
+
+    visibleFlags[triIdx] = 0;
+
+    __global const DrawRange* range = &ranges[find_range_by_triangle(ranges, numRanges, triIdx)];
+    int modelIdx = range->model;
+    __global const CustomModel* model = &models[modelIdx];
+    int meshTriIdx = model->meshTriangleOffset + (triIdx - range->triangleOffset);
+    __global const Triangle* tri = &tris[meshTriIdx];
+
+    float4 pv0 = projVerts[range->vertexOffset + tri->indices[0]];
+    float4 pv1 = projVerts[range->vertexOffset + tri->indices[1]];
+    float4 pv2 = projVerts[range->vertexOffset + tri->indices[2]];
+
+    if (pv0.w >= 0 || pv1.w >= 0 || pv2.w >= 0) return;
+
+    float area = (pv1.x - pv0.x) * (pv2.y - pv0.y)
+               - (pv1.y - pv0.y) * (pv2.x - pv0.x);
+    if (area <= 0.0f) return;
+
+    int minX = max(0,          (int)floor(fmin(pv0.x, fmin(pv1.x, pv2.x))));
+    int maxX = min(width - 1,  (int)ceil (fmax(pv0.x, fmax(pv1.x, pv2.x))));
+    int minY = max(rowStart,   (int)floor(fmin(pv0.y, fmin(pv1.y, pv2.y))));
+    int maxY = min(rowEnd - 1, (int)ceil (fmax(pv0.y, fmax(pv1.y, pv2.y))));
+    if (minX > maxX || minY > maxY) return; // outside this device's rows
+
+    TriMeta meta;
+    meta.triIndex = meshTriIdx;
+    meta.minX = minX; meta.maxX = maxX;
+    meta.minY = minY; meta.maxY = maxY;
+    meta.v0 = (Vec2){pv0.x, pv0.y};
+    meta.v1 = (Vec2){pv1.x, pv1.y};
+    meta.v2 = (Vec2){pv2.x, pv2.y};
+    meta.z0 = pv0.z / pv0.w;
+    meta.z1 = pv1.z / pv1.w;
+    meta.z2 = pv2.z / pv2.w;
+    meta.w0 = pv0.w; meta.w1 = pv1.w; meta.w2 = pv2.w;
+    // raster_triangle's barycentrics sum to 0.5, its depth spans half the vertex range
+    meta.zMin = 0.5f * fmin(meta.z0, fmin(meta.z1, meta.z2));
+    meta.zMax = 0.5f * fmax(meta.z0, fmax(meta.z1, meta.z2));
+    meta.invArea = 1.0f / area;
+    meta.modelIndex = modelIdx;
+    meta.vertexOffset = model->meshVertexOffset;
+    meta.texOffset = model->pixelOffset;
+    meta.texW = model->texWidth;
+    meta.texH = model->texHeight;
+    meta.texLevels = model->texLevels;
+
+    setupMeta[triIdx] = meta;
+    visibleFlags[triIdx] = 1;
+}
+
+inline int scan_local(__local int* temp, int lid, int v)
+{
+    temp[lid] = v;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int offset = 1; offset < SCAN_BLOCK; offset <<= 1)
+    {
+        int t = lid >= offset ? temp[lid - offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        temp[lid] += t;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    return temp[lid] - v; // exclusive
+}
+
+// Exclusive scan of the visibility flags inside each SCAN_BLOCK-sized group,
+// group totals go to blockSums for scan_block_sums.
+__kernel void scan_blocks(
+    __global const int* visibleFlags,
+    __global int* scanOffsets,
+    __global int* blockSums,
+    int count)
+{
+    __local int temp[SCAN_BLOCK];
+    int gid = get_global_id(0);
+    int lid = get_local_id(0);
+
+    int v = gid < count ? visibleFlags[gid] : 0;
+    int offset = scan_local(temp, lid, v);
+
+    if (gid < count) scanOffsets[gid] = offset;
+    if (lid == SCAN_BLOCK - 1) blockSums[get_group_id(0)] = offset + v;
+}
+
+// Launched as a single work-group, turns blockSums into exclusive block offsets.
+__kernel void scan_block_sums(
+    __global int* blockSums,
+    int numBlocks,
+    __global int* visibleCount)
+{
+    __local int temp[SCAN_BLOCK];
+    int lid = get_local_id(0);
+    int carry = 0;
+
+    for (int base = 0; base < numBlocks; base += SCAN_BLOCK)
+    {
+        int i = base + lid;
+        int v = i < numBlocks ? blockSums[i] : 0;
+        int offset = scan_local(temp, lid, v);
+        int total = temp[SCAN_BLOCK - 1];
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (i < numBlocks) blockSums[i] = carry + offset;
+        carry += total;
+    }
+
+    if (lid == 0) *visibleCount = carry;
+}
+
+__kernel void compact_kernel(
+    __global const TriMeta* setupMeta,
+    __global const int* visibleFlags,
+    __global const int* scanOffsets,
+    __global const int* blockSums,
+    __global TriMeta* triMeta,
+    int totalTriangles)
+{
+    int i = get_global_id(0);
+    if (i >= totalTriangles || !visibleFlags[i]) return;
+
+    triMeta[blockSums[i / SCAN_BLOCK] + scanOffsets[i]] = setupMeta[i];
+}
+
 inline float SignedTriangleArea(float2 a, float2 b, float2 c)
 {
     return 0.5f * ((b.x - a.x)*(c.y - a.y) - (b.y - a.y)*(c.x - a.x));
 }
 
-inline Pixel sample_texture(__global Pixel* texture, int texWidth, int texHeight, float2 uv)
+// Floats mapped to ints with the same ordering, so atomic_min works on depth
+inline int depth_key(float depth)
+{
+    int bits = as_int(depth);
+    return bits >= 0 ? bits : bits ^ 0x7FFFFFFF;
+}
+
+// One work-item per visible triangle: every tile the triangle covers completely
+// can end up no deeper than the triangle's deepest point inside it, the
+// smallest such bound per tile goes to tileDepth for bin_kernel to test against.
+__kernel void hiz_kernel(
+    __global TriMeta* triMeta,
+    __global int* visibleCount,
+    __global int* tileDepth,
+    int width,
+    int height)
+{
+    FIXED_RESOLUTION(width, height);
+    int i = get_global_id(0);
+    if (i >= *visibleCount) return;
+
+    __global const TriMeta* meta = &triMeta[i];
+    float2 v0 = (float2)(meta->v0.x, meta->v0.y);
+    float2 v1 = (float2)(meta->v1.x, meta->v1.y);
+    float2 v2 = (float2)(meta->v2.x, meta->v2.y);
+
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    for (int ty = meta->minY / TILE_SIZE; ty <= meta->maxY / TILE_SIZE; ty++)
+    {
+        for (int tx = meta->minX / TILE_SIZE; tx <= meta->maxX / TILE_SIZE; tx++)
+        {
+            // Corner pixel centers of the on-screen part of the tile, coverage
+            // and depth are affine so the corners bound every pixel between them
+            float x0 = tx * TILE_SIZE + 0.5f, x1 = min((tx + 1) * TILE_SIZE, width) - 0.5f;
+            float y0 = ty * TILE_SIZE + 0.5f, y1 = min((ty + 1) * TILE_SIZE, height) - 0.5f;
+            float2 corners[4] = { (float2)(x0, y0), (float2)(x1, y0), (float2)(x0, y1), (float2)(x1, y1) };
+
+            bool covered = true;
+            float deepest = -FLT_MAX;
+            for (int c = 0; c < 4 && covered; c++)
+            {
+                float a = SignedTriangleArea(corners[c], v1, v2) * meta->invArea;
+                float b = SignedTriangleArea(corners[c], v2, v0) * meta->invArea;
+                float g = SignedTriangleArea(corners[c], v0, v1) * meta->invArea;
+                covered = a >= 0 && b >= 0 && g >= 0;
+                deepest = fmax(deepest, a*meta->z0 + b*meta->z1 + g*meta->z2);
+            }
+
+            if (covered)
+                atomic_min(&tileDepth[ty * tilesX + tx], depth_key(deepest));
+        }
+    }
+}
+
+// Coarse level of the depth pyramid, one work-item per HIZ_GROUP x HIZ_GROUP
+// block of tiles. x is the nearest tile bound in the block, y the deepest:
+// a triangle nearer than x passes every tile test in it, one behind y fails them all
+__kernel void hiz_reduce_kernel(
+    __global const int* tileDepth,
+    __global int2* hizGroups,
+    int width,
+    int height)
+{
+    FIXED_RESOLUTION(width, height);
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    int groupsX = (tilesX + HIZ_GROUP - 1) / HIZ_GROUP;
+    int groupsY = (tilesY + HIZ_GROUP - 1) / HIZ_GROUP;
+    int g = get_global_id(0);
+    if (g >= groupsX * groupsY) return;
+
+    int gx = g % groupsX, gy = g / groupsX;
+    int nearest = INT_MAX, deepest = INT_MIN;
+    for (int ty = gy * HIZ_GROUP; ty < min((gy + 1) * HIZ_GROUP, tilesY); ty++)
+    {
+        for (int tx = gx * HIZ_GROUP; tx < min((gx + 1) * HIZ_GROUP, tilesX); tx++)
+        {
+            int bound = tileDepth[ty * tilesX + tx];
+            nearest = min(nearest, bound);
+            deepest = max(deepest, bound);
+        }
+    }
+    hizGroups[g] = (int2)(nearest, deepest);
+}
+
+// True when every group the triangle's bounding box touches hides it
+inline bool hiz_hidden(__global const TriMeta* meta, __global const int2* hizGroups, int width)
+{
+    int groupsX = ((width + TILE_SIZE - 1) / TILE_SIZE + HIZ_GROUP - 1) / HIZ_GROUP;
+    int nearest = depth_key(meta->zMin);
+    int groupSize = TILE_SIZE * HIZ_GROUP;
+
+    for (int gy = meta->minY / groupSize; gy <= meta->maxY / groupSize; gy++)
+        for (int gx = meta->minX / groupSize; gx <= meta->maxX / groupSize; gx++)
+            if (nearest <= hizGroups[gy * groupsX + gx].y) return false;
+    return true;
+}
+
+// One work-item per visible triangle: appends it to every screen tile its
+// bounding box overlaps, unless the tile is already known to hide it. Tiles
+// are walked per group, whole groups are rejected or accepted from hizGroups
+// and only the groups in between read the per-tile bounds
+__kernel void bin_kernel(
+    __global TriMeta* triMeta,
+    __global int* visibleCount,
+    __global int* tileCounts,
+    __global int* tileTris,
+    int width,
+    __global const int* tileDepth,
+    __global const int2* hizGroups)
+{
+    FIXED_WIDTH(width);
+    int i = get_global_id(0);
+    if (i >= *visibleCount) return;
+
+    __global const TriMeta* meta = &triMeta[i];
+    int nearest = depth_key(meta->zMin);
+
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int groupsX = (tilesX + HIZ_GROUP - 1) / HIZ_GROUP;
+    int minTX = meta->minX / TILE_SIZE, maxTX = meta->maxX / TILE_SIZE;
+    int minTY = meta->minY / TILE_SIZE, maxTY = meta->maxY / TILE_SIZE;
+
+    for (int gy = minTY / HIZ_GROUP; gy <= maxTY / HIZ_GROUP; gy++)
+    {
+        for (int gx = minTX / HIZ_GROUP; gx <= maxTX / HIZ_GROUP; gx++)
+        {
+            int2 group = hizGroups[gy * groupsX + gx];
+            if (nearest > group.y) continue; // behind the occluders of every tile in the group
+            bool accepted = nearest <= group.x; // in front of all of them, no tile test needed
+
+            for (int ty = max(minTY, gy * HIZ_GROUP); ty <= min(maxTY, gy * HIZ_GROUP + HIZ_GROUP - 1); ty++)
+            {
+                for (int tx = max(minTX, gx * HIZ_GROUP); tx <= min(maxTX, gx * HIZ_GROUP + HIZ_GROUP - 1); tx++)
+                {
+                    int tile = ty * tilesX + tx;
+                    if (!accepted && nearest > tileDepth[tile]) continue; // behind a full-tile occluder
+
+                    int slot = atomic_inc(&tileCounts[tile]);
+                    if (slot < TILE_MAX_TRIS)
+                        tileTris[tile * TILE_MAX_TRIS + slot] = i;
+                }
+            }
+        }
+    }
+}
+
+inline int morton_spread(int v)
+{
+  v = (v | (v << 2)) & 0x33;
+  return (v | (v << 1)) & 0x55;
+}
+
+inline int texel_index(int x, int y, int width)
+{
+  int blocksX = (width + TEX_BLOCK - 1) / TEX_BLOCK;
+  int block = (y / TEX_BLOCK) * blocksX + (x / TEX_BLOCK);
+  return block * TEX_BLOCK * TEX_BLOCK + (morton_spread(x % TEX_BLOCK) | (morton_spread(y % TEX_BLOCK) << 1));
+}
+
+inline float4 fetch_texel(__global const Pixel* level, int width, int height, int x, int y)
+{
+  x = clamp(x, 0, width - 1);
+  y = clamp(y, 0, height - 1);
+  Pixel p = level[texel_index(x, y, width)];
+  return (float4)(p.r, p.g, p.b, p.a);
+}
+
+// Walks the chain to level, every level is padded to whole blocks
+inline __global const Pixel* texture_level(__global const Pixel* texture, int level, int* width, int* height)
+{
+  for (int l = 0; l < level; l++)
+  {
+    texture += ((*width + TEX_BLOCK - 1) / TEX_BLOCK) * ((*height + TEX_BLOCK - 1) / TEX_BLOCK) * TEX_BLOCK * TEX_BLOCK;
+    *width = max(1, *width / 2);
+    *height = max(1, *height / 2);
+  }
+  return texture;
+}
+
+inline float4 sample_bilinear(__global const Pixel* level, int width, int height, float2 uv)
+{
+  float x = uv.x * width - 0.5f;
+  float y = (1.0f - uv.y) * height - 0.5f;
+  float fx = floor(x), fy = floor(y);
+  int x0 = (int)fx, y0 = (int)fy;
+  float tx = x - fx, ty = y - fy;
+
+  float4 top = mix(fetch_texel(level, width, height, x0, y0),     fetch_texel(level, width, height, x0 + 1, y0),     tx);
+  float4 bot = mix(fetch_texel(level, width, height, x0, y0 + 1), fetch_texel(level, width, height, x0 + 1, y0 + 1), tx);
+  return mix(top, bot, ty);
+}
+
+// uvDx/uvDy are the uv steps to the next pixel in x and y, they pick the level
+inline float3 sample_texture(__global const Pixel* texture, int texWidth, int texHeight, int texLevels,
+                             float2 uv, float2 uvDx, float2 uvDy)
 {
   uv.x = clamp(uv.x, 0.001f, 0.999f);
   uv.y = clamp(uv.y, 0.001f, 0.999f);
 
+#if TEXTURE_FILTER == 0
   int u = (int)floor(uv.x * (texWidth - 1) + 0.5f);
   int v = (int)floor((1.0f - uv.y) * (texHeight - 1) + 0.5f);
+  return fetch_texel(texture, texWidth, texHeight, u, v).xyz / 255.0f;
+#else
+  float2 size = (float2)(texWidth, texHeight);
+  float rho = fmax(length(uvDx * size), length(uvDy * size));
+  float lod = clamp(log2(fmax(rho, 1e-6f)), 0.0f, (float)(texLevels - 1));
+
+  int level = (int)lod;
+  int w = texWidth, h = texHeight;
+  __global const Pixel* base = texture_level(texture, level, &w, &h);
+  float4 color = sample_bilinear(base, w, h, uv);
+
+#if TEXTURE_FILTER == 2
+  float blend = lod - level;
+  if (blend > 0.0f && level + 1 < texLevels)
+  {
+    __global const Pixel* next = texture_level(base, 1, &w, &h);
+    color = mix(color, sample_bilinear(next, w, h, uv), blend);
+  }
+#endif
+  return color.xyz / 255.0f;
+#endif
+}
+
+// Same perspective weighting as the shaded attributes
+inline float2 interpolate_uv(float2 uv0, float2 uv1, float2 uv2, float a, float b, float g,
+                             float z0, float z1, float z2)
+{
+  return (uv0 * (a * z0) + uv1 * (b * z1) + uv2 * (g * z2)) / (a*z0 + b*z1 + g*z2);
+}
+
+inline float4 mat4_mul(__global const Mat4* m, float4 v)
+{
+    return (float4)(v.x * m->x0 + v.y * m->x1 + v.z * m->x2 + v.w * m->x3,
+                    v.x * m->y0 + v.y * m->y1 + v.z * m->y2 + v.w * m->y3,
+                    v.x * m->z0 + v.y * m->z1 + v.z * m->z2 + v.w * m->z3,
+                    v.x * m->w0 + v.y * m->w1 + v.z * m->w2 + v.w * m->w3);
+}
+
+// One work-item per light: the corners of the light's world box through the
+// same transform as vertex_kernel give a conservative screen rectangle and
+// depth range. Boxes reaching behind the camera cover the whole screen
+__kernel void light_bounds(
+    __global Light* lights,
+    int numLights,
+    __global Mat4* projection,
+    __global Mat4* view,
+    int width,
+    int height,
+    __global LightBounds* bounds)
+{
+    FIXED_RESOLUTION(width, height);
+    int i = get_global_id(0);
+    if (i >= numLights) return;
+
+    __global const Light* light = &lights[i];
+    LightBounds b = { FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, FLT_MAX, 0.0f };
+    bool behind = false;
+
+    for (int c = 0; c < 8; c++)
+    {
+        float4 corner = (float4)(light->position.x + ((c & 1) ? light->range : -light->range),
+                                 light->position.y + ((c & 2) ? light->range : -light->range),
+                                 light->position.z + ((c & 4) ? light->range : -light->range),
+                                 1.0f);
+        float4 clip = mat4_mul(projection, mat4_mul(view, corner));
+
+        float depth = -clip.w; // visible geometry has w < 0
+        b.minDepth = fmin(b.minDepth, depth);
+        b.maxDepth = fmax(b.maxDepth, depth);
+        if (depth <= 1e-4f) { behind = true; continue; }
 
-  return texture[v * texWidth + u];
+        float sx = (clip.x / clip.w * 0.5f + 0.5f) * (float)width;
+        float sy = (clip.y / clip.w * 0.5f + 0.5f) * (float)height;
+        b.minX = fmin(b.minX, sx); b.maxX = fmax(b.maxX, sx);
+        b.minY = fmin(b.minY, sy); b.maxY = fmax(b.maxY, sy);
+    }
+
+    if (behind)
+    {
+        b.minX = 0.0f; b.maxX = (float)width;
+        b.minY = 0.0f; b.maxY = (float)height;
+        b.minDepth = 0.0f;
+    }
+    bounds[i] = b;
+}
+
+// One work-item per cluster, collects the lights whose bounds overlap it
+__kernel void cluster_lights(
+    __global LightBounds* bounds,
+    int numLights,
+    __global int* clusterCounts,
+    __global int* clusterLights,
+    int width,
+    int height,
+    float nearPlane,
+    float farPlane)
+{
+    FIXED_RESOLUTION(width, height);
+    int c = get_global_id(0);
+    int clustersX = (width + CLUSTER_TILE - 1) / CLUSTER_TILE;
+    int clustersY = (height + CLUSTER_TILE - 1) / CLUSTER_TILE;
+    if (c >= clustersX * clustersY * CLUSTER_SLICES) return;
+
+    int slice = c % CLUSTER_SLICES;
+    int tile = c / CLUSTER_SLICES;
+    float x0 = (float)((tile % clustersX) * CLUSTER_TILE), x1 = x0 + CLUSTER_TILE;
+    float y0 = (float)((tile / clustersX) * CLUSTER_TILE), y1 = y0 + CLUSTER_TILE;
+
+    // The first and last slices also take what lies before near and past far
+    float ratio = farPlane / nearPlane;
+    float z0 = slice == 0 ? 0.0f : nearPlane * pow(ratio, (float)slice / CLUSTER_SLICES);
+    float z1 = slice == CLUSTER_SLICES - 1 ? FLT_MAX : nearPlane * pow(ratio, (float)(slice + 1) / CLUSTER_SLICES);
+
+    __global int* list = &clusterLights[c * CLUSTER_MAX_LIGHTS];
+    int count = 0;
+    for (int i = 0; i < numLights && count < CLUSTER_MAX_LIGHTS; i++)
+    {
+        __global const LightBounds* b = &bounds[i];
+        if (b->maxX < x0 || b->minX >= x1 || b->maxY < y0 || b->minY >= y1) continue;
+        if (b->maxDepth < z0 || b->minDepth >= z1) continue;
+        list[count++] = i;
+    }
+    clusterCounts[c] = count;
+}
+
+// Cluster of a covered pixel, slice from the perspective-correct view depth
+inline int light_cluster(__global const TriMeta* meta, int x, int y, float a, float b, float g,
+                         int width, float nearPlane, float farPlane)
+{
+    // 1/w is affine in screen space, the barycentrics sum to 0.5
+    float invW = 2.0f * (a / meta->w0 + b / meta->w1 + g / meta->w2);
+    float viewDepth = -1.0f / invW;
+
+    int slice = (int)floor(log(viewDepth / nearPlane) / log(farPlane / nearPlane) * CLUSTER_SLICES);
+    slice = clamp(slice, 0, CLUSTER_SLICES - 1);
+
+    int clustersX = (width + CLUSTER_TILE - 1) / CLUSTER_TILE;
+    return ((y / CLUSTER_TILE) * clustersX + x / CLUSTER_TILE) * CLUSTER_SLICES + slice;
+}
+
+// Diffuse contribution of a point or spot light, fading out at its range
+inline float3 point_light(__global const Light* light, float3 position, float3 normal)
+{
+    float3 toLight = (float3)(light->position.x, light->position.y, light->position.z) - position;
+    float dist = length(toLight);
+    if (dist >= light->range || dist <= 0.0f) return (float3)(0.0f);
+
+    float3 L = toLight / dist;
+    float falloff = 1.0f - dist / light->range;
+    float attenuation = falloff * falloff * light->intensity;
+
+    if (light->spotCos > -1.0f)
+    {
+        float3 dir = normalize((float3)(light->direction.x, light->direction.y, light->direction.z));
+        attenuation *= smoothstep(light->spotCos, mix(light->spotCos, 1.0f, 0.1f), dot(-L, dir));
+    }
+
+    return (float3)(light->color.x, light->color.y, light->color.z) * attenuation * fmax(dot(normal, L), 0.0f);
+}
+
+// Perspective-correct attribute interpolation, texturing and lighting for one
+// covered pixel of the triangle described by meta. Beside the fixed directional
+// light every light assigned to the pixel's cluster is evaluated
+inline float3 shade_fragment(
+    __global const TriMeta* meta,
+    float a,
+    float b,
+    float g,
+    float depth,
+    __global Triangle* tris2,
+    __global Vertex* verts,
+    __global Pixel* textures,
+    __global const CustomModel* models,
+    __global const Light* lights,
+    __global const int* clusterCounts,
+    __global const int* clusterLights,
+    int cluster)
+{
+    float z0 = meta->z0;
+    float z1 = meta->z1;
+    float z2 = meta->z2;
+
+    __global const Triangle* t = &tris2[meta->triIndex];
+    __global const Vertex* t0 = &verts[meta->vertexOffset + t->indices[0]];
+    __global const Vertex* t1 = &verts[meta->vertexOffset + t->indices[1]];
+    __global const Vertex* t2 = &verts[meta->vertexOffset + t->indices[2]];
+
+    float3 texColor;
+#if TEXTURE_MODE == 2
+    texColor = (float3)(0.8f, 0.8f, 0.8f);
+#else
+    float2 uv0 = vertex_uv(t0);
+    float2 uv1 = vertex_uv(t1);
+    float2 uv2 = vertex_uv(t2);
+
+    float2 uv = (uv0 * (a * z0) +
+                 uv1 * (b * z1) +
+                 uv2 * (g * z2)) / depth;
+
+    // Barycentrics are affine in screen space, their per-pixel steps follow
+    // from the edge functions and give the uv footprint of this pixel
+    float2 v0 = (float2)(meta->v0.x, meta->v0.y);
+    float2 v1 = (float2)(meta->v1.x, meta->v1.y);
+    float2 v2 = (float2)(meta->v2.x, meta->v2.y);
+    float hk = 0.5f * meta->invArea;
+    float3 dBary_dx = (float3)(v1.y - v2.y, v2.y - v0.y, v0.y - v1.y) * hk;
+    float3 dBary_dy = (float3)(v2.x - v1.x, v0.x - v2.x, v1.x - v0.x) * hk;
+    float2 uvDx = interpolate_uv(uv0, uv1, uv2, a + dBary_dx.x, b + dBary_dx.y, g + dBary_dx.z, z0, z1, z2) - uv;
+    float2 uvDy = interpolate_uv(uv0, uv1, uv2, a + dBary_dy.x, b + dBary_dy.y, g + dBary_dy.z, z0, z1, z2) - uv;
+
+    int tw = meta->texW;
+    int th = meta->texH;
+
+#if TEXTURE_MODE == 1
+    texColor = sample_texture(&textures[meta->texOffset], tw, th, meta->texLevels, uv, uvDx, uvDy);
+#else
+    if (tw > 0 && th > 0) {
+        texColor = sample_texture(&textures[meta->texOffset], tw, th, meta->texLevels, uv, uvDx, uvDy);
+    } else {
+        texColor = (float3)(0.8f, 0.8f, 0.8f);
+    }
+#endif
+#endif
+
+#if LIGHTING
+    float3 dirToLight = normalize(LIGHT_DIR);
+
+    float3 norm0 = vertex_normal(t0);
+    float3 norm1 = vertex_normal(t1);
+    float3 norm2 = vertex_normal(t2);
+    float3 norm = normalize((norm0*(a*z0) + norm1*(b*z1) + norm2*(g*z2)) / depth);
+
+    float light_intensity = fmax(0.1f, dot(norm, dirToLight));
+    float3 color = texColor * light_intensity;
+
+    int numLights = clusterCounts[cluster];
+    if (numLights > 0)
+    {
+        __global const CustomModel* model = &models[meta->modelIndex];
+        float3 p = (vertex_position(t0, model) * (a*z0) +
+                    vertex_position(t1, model) * (b*z1) +
+                    vertex_position(t2, model) * (g*z2)) / depth;
+        float3 worldPos = mat4_mul(&model->transform, (float4)(p, 1.0f)).xyz;
+        float3 worldNorm = normalize(mat4_mul(&model->transform, (float4)(norm, 0.0f)).xyz);
+
+        __global const int* list = &clusterLights[cluster * CLUSTER_MAX_LIGHTS];
+        for (int i = 0; i < numLights; i++)
+            color += texColor * point_light(&lights[list[i]], worldPos, worldNorm);
+    }
+    return fmin(color, (float3)(1.0f));
+#else
+    return texColor;
+#endif
+}
+
+inline Pixel to_pixel(float3 color)
+{
+    return (Pixel){ (uchar)(color.x * 255), (uchar)(color.y * 255), (uchar)(color.z * 255), 255 };
+}
+
+inline void raster_triangle(
+    __global const TriMeta* meta,
+    int x,
+    int y,
+    __global Pixel* pixels,
+    __global float* depthBuffer,
+    __global Triangle* tris2,
+    __global Vertex* verts,
+    __global Pixel* textures,
+    int width,
+    __global const CustomModel* models,
+    __global const Light* lights,
+    __global const int* clusterCounts,
+    __global const int* clusterLights,
+    float nearPlane,
+    float farPlane)
+{
+    if (x < meta->minX || x > meta->maxX || y < meta->minY || y > meta->maxY)
+        return;
+
+    int idx = y * width + x;
+    float2 P = (float2)(x + 0.5f, y + 0.5f); // pixel center
+
+    float2 v0 = (float2)(meta->v0.x, meta->v0.y);
+    float2 v1 = (float2)(meta->v1.x, meta->v1.y);
+    float2 v2 = (float2)(meta->v2.x, meta->v2.y);
+
+    float a = SignedTriangleArea(P, v1, v2) * meta->invArea;
+    float b = SignedTriangleArea(P, v2, v0) * meta->invArea;
+    float g = SignedTriangleArea(P, v0, v1) * meta->invArea;
+
+    if (a >= 0 && b >= 0 && g >= 0)
+    {
+        float depth = a*meta->z0 + b*meta->z1 + g*meta->z2;
+
+        if (depth < depthBuffer[idx])
+        {
+            int cluster = light_cluster(meta, x, y, a, b, g, width, nearPlane, farPlane);
+            pixels[idx] = to_pixel(shade_fragment(meta, a, b, g, depth, tris2, verts, textures,
+                                                  models, lights, clusterCounts, clusterLights, cluster));
+            depthBuffer[idx] = depth;
+        }
+    }
 }
 
 __kernel void fragment_kernel(
     __global Pixel* pixels,
-    __global float4* projVerts,
     int width,
     int height,
     __global float* depthBuffer,
     __global float3* cameraPos,
     __global Triangle* tris2,
+    __global Vertex* verts,
+    __global Pixel* textures,
+    __global TriMeta* triMeta,
+    __global int* visibleCount,
+    __global int* tileCounts,
+    __global int* tileTris,
+    __global int* tileDepth,
     __global CustomModel* models,
-    int numModels, 
-    __global Pixel* textures)
+    __global Light* lights,
+    __global int* clusterCounts,
+    __global int* clusterLights,
+    float nearPlane,
+    float farPlane)
 {
+    FIXED_RESOLUTION(width, height);
     int x = get_global_id(0);
     int y = get_global_id(1);
     if (x >= width || y >= height) return;
 
-    int idx = y * width + x;
-    float2 P = (float2)(x + 0.5f, y + 0.5f); // pixel center
-
-    float3 dirToLight = normalize((float3){5.0f, 5.0f, 0.0f});
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int tile = (y / TILE_SIZE) * tilesX + (x / TILE_SIZE);
+    int count = tileCounts[tile];
 
-    for (int modelidx = 0; modelidx < numModels; modelidx++)
+    if (count > TILE_MAX_TRIS)
     {
-        __global const CustomModel* model = &models[modelidx];
+        // Tile list overflowed during binning, walk every visible triangle instead
+        int numVisible = *visibleCount;
+        int tileMax = tileDepth[tile];
+        for (int i = 0; i < numVisible; i++)
+            if (depth_key(triMeta[i].zMin) <= tileMax)
+                raster_triangle(&triMeta[i], x, y, pixels, depthBuffer, tris2, verts, textures, width,
+                                models, lights, clusterCounts, clusterLights, nearPlane, farPlane);
+        return;
+    }
 
-        for (int triIdx = model->triangleOffset;
-             triIdx < model->triangleOffset + model->triangleCount;
-             triIdx++)
-        {
-            float4 pv0 = projVerts[triIdx * 3 + 0];
-            float4 pv1 = projVerts[triIdx * 3 + 1];
-            float4 pv2 = projVerts[triIdx * 3 + 2];
+    __global const int* list = &tileTris[tile * TILE_MAX_TRIS];
+    for (int i = 0; i < count; i++)
+        raster_triangle(&triMeta[list[i]], x, y, pixels, depthBuffer, tris2, verts, textures, width,
+                        models, lights, clusterCounts, clusterLights, nearPlane, farPlane);
+}
+
+// 64-bit atom_min is part of the extended atomics, base only has add/xchg/cmpxchg
+#if defined(cl_khr_int64_base_atomics) && defined(cl_khr_int64_extended_atomics)
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
 
-            if (pv0.w >= 0 || pv1.w >= 0 || pv2.w >= 0)
-                continue; // discard whole triangle
+// Triangle-parallel raster into the visibility buffer. The work-items along
+// dimension 1 share one visible triangle and stride over its bounding box,
+// each covered pixel keeps the nearest (depth key, triangle) pair, depth in
+// the high half so one 64-bit atomic_min resolves the depth test
+__kernel void visibility_kernel(
+    __global TriMeta* triMeta,
+    __global int* visibleCount,
+    __global ulong* visibility,
+    __global int* tileDepth,
+    int width,
+    __global const int2* hizGroups)
+{
+    FIXED_WIDTH(width);
+    int t = get_global_id(0);
+    if (t >= *visibleCount) return;
 
-            float2 v0 = (float2)(pv0.x, pv0.y);
-            float2 v1 = (float2)(pv1.x, pv1.y);
-            float2 v2 = (float2)(pv2.x, pv2.y);
+    __global const TriMeta* meta = &triMeta[t];
+    if (hiz_hidden(meta, hizGroups, width)) return; // skips the whole bounding box walk
+    float2 v0 = (float2)(meta->v0.x, meta->v0.y);
+    float2 v1 = (float2)(meta->v1.x, meta->v1.y);
+    float2 v2 = (float2)(meta->v2.x, meta->v2.y);
 
-            float area = (v1.x - v0.x) * (v2.y - v0.y)
-                       - (v1.y - v0.y) * (v2.x - v0.x);
+    int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    int boxWidth = meta->maxX - meta->minX + 1;
+    int boxArea = boxWidth * (meta->maxY - meta->minY + 1);
 
-            if (area <= 0.0f) continue;  // Cull triangle
+    for (int p = get_global_id(1); p < boxArea; p += get_global_size(1))
+    {
+        int x = meta->minX + p % boxWidth;
+        int y = meta->minY + p / boxWidth;
+        float2 P = (float2)(x + 0.5f, y + 0.5f);
 
-            float a = SignedTriangleArea(P, v1, v2) / area;
-            float b = SignedTriangleArea(P, v2, v0) / area;
-            float g = SignedTriangleArea(P, v0, v1) / area;
+        float a = SignedTriangleArea(P, v1, v2) * meta->invArea;
+        float b = SignedTriangleArea(P, v2, v0) * meta->invArea;
+        float g = SignedTriangleArea(P, v0, v1) * meta->invArea;
+        if (a < 0 || b < 0 || g < 0) continue;
 
-            if (a >= 0 && b >= 0 && g >= 0)
-            {
-                float z0 = pv0.z / pv0.w;
-                float z1 = pv1.z / pv1.w;
-                float z2 = pv2.z / pv2.w;
-                float depth = a*z0 + b*z1 + g*z2;
+        // Behind the tile's depth bound, some covering triangle is nearer
+        int key = depth_key(a*meta->z0 + b*meta->z1 + g*meta->z2);
+        if (key > tileDepth[(y / TILE_SIZE) * tilesX + x / TILE_SIZE]) continue;
 
-                if (depth < depthBuffer[idx])
-                {
-                    __global const Triangle* t = &tris2[triIdx];
-
-                    float2 uv0 = (float2){t->uv[0].x,t->uv[0].y};
-                    float2 uv1 = (float2){t->uv[1].x,t->uv[1].y};
-                    float2 uv2 = (float2){t->uv[2].x,t->uv[2].y};
-
-                    float2 uv = (uv0 * (a * z0) +
-                                 uv1 * (b * z1) +
-                                 uv2 * (g * z2)) / depth;
-
-                    float3 norm0 = (float3){t->normal[0].x,t->normal[0].y,t->normal[0].z};
-                    float3 norm1 = (float3){t->normal[1].x,t->normal[1].y,t->normal[1].z};
-                    float3 norm2 = (float3){t->normal[2].x,t->normal[2].y,t->normal[2].z};
-                    float3 norm = normalize((norm0*(a*z0) + norm1*(b*z1) + norm2*(g*z2)) / depth);
-
-                    int texOffset = model->pixelOffset;
-                    int tw = model->texWidth;
-                    int th = model->texHeight;
-
-                    float3 texColor;
-                    if (tw > 0 && th > 0) {
-                        Pixel texel = sample_texture(&textures[texOffset], tw, th, uv);
-                        texColor = (float3){texel.r, texel.g, texel.b} / 255.0f;
-                    } else {
-                        texColor = (float3)(0.8f, 0.8f, 0.8f);
-                    }
-                
-                    float light_intensity = fmax(0.1f, dot(norm, dirToLight));
-                    float3 finalColor = texColor * light_intensity;
-
-                    pixels[idx] = (Pixel){
-                        (uchar)(finalColor.x * 255),
-                        (uchar)(finalColor.y * 255),
-                        (uchar)(finalColor.z * 255),
-                        255
-                    };
-
-                    depthBuffer[idx] = depth;
-                }
-            }
-        }
+        ulong packed = ((ulong)((uint)key ^ 0x80000000u) << 32) | (uint)t;
+        atom_min(&visibility[y * width + x], packed);
     }
 }
+#endif
+
+// Full-screen pass after visibility_kernel, shades each covered pixel exactly
+// once from the triangle that won its depth test
+__kernel void resolve_kernel(
+    __global Pixel* pixels,
+    int width,
+    int height,
+    __global ulong* visibility,
+    __global Triangle* tris2,
+    __global Vertex* verts,
+    __global Pixel* textures,
+    __global TriMeta* triMeta,
+    __global CustomModel* models,
+    __global Light* lights,
+    __global int* clusterCounts,
+    __global int* clusterLights,
+    float nearPlane,
+    float farPlane)
+{
+    FIXED_RESOLUTION(width, height);
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+    if (x >= width || y >= height) return;
+
+    int idx = y * width + x;
+    ulong packed = visibility[idx];
+    if (packed == ULONG_MAX) return; // background, written by clear_buffers
+
+    __global const TriMeta* meta = &triMeta[(uint)packed];
+    float2 P = (float2)(x + 0.5f, y + 0.5f);
+    float2 v0 = (float2)(meta->v0.x, meta->v0.y);
+    float2 v1 = (float2)(meta->v1.x, meta->v1.y);
+    float2 v2 = (float2)(meta->v2.x, meta->v2.y);
+
+    float a = SignedTriangleArea(P, v1, v2) * meta->invArea;
+    float b = SignedTriangleArea(P, v2, v0) * meta->invArea;
+    float g = SignedTriangleArea(P, v0, v1) * meta->invArea;
+    float depth = a*meta->z0 + b*meta->z1 + g*meta->z2;
+
+    int cluster = light_cluster(meta, x, y, a, b, g, width, nearPlane, farPlane);
+    pixels[idx] = to_pixel(shade_fragment(meta, a, b, g, depth, tris2, verts, textures,
+                                          models, lights, clusterCounts, clusterLights, cluster));
+}
@@ -0,0 +1,183 @@
+#define GABMATH_IMPLEMENTATION
+#include "gab_math.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+// Checks the batch functions of gab_math.h against the scalar ones, CMake
+// builds it once per path (SSE2, GABMATH_SCALAR, AVX). Counts are odd so the
+// vector loops and the remainder loops both run
+
+#define MATRICES 7
+#define POINTS 13
+#define EPSILON 1e-4f
+
+static int s_failures = 0;
+
+static void expect_near(const char* what, int index, float got, float want)
+{
+  if (fabsf(got - want) <= EPSILON * fmaxf(1.0f, fabsf(want))) return;
+  printf("%s[%d]: got %f, expected %f\n", what, index, got, want);
+  s_failures++;
+}
+
+static void expect_matrix(const char* what, int index, const f4x4* got, const f4x4* want)
+{
+  for (int r = 0; r < 4; r++)
+    for (int c = 0; c < 4; c++)
+      expect_near(what, index, got->f[r][c], want->f[r][c]);
+}
+
+static f4x4 test_transform(int i)
+{
+  return MatTransform((f3){ 0.5f * i, -1.0f + i, 2.0f - 0.25f * i },
+                      (f3){ 10.0f * i, 25.0f + 7.0f * i, -15.0f * i },
+                      (f3){ 1.0f, 1.0f, 1.0f });
+}
+
+static void test_mat_mul_array()
+{
+  f4x4 a = MatMul(MatPerspective(1.5f, 4.0f / 3.0f, 0.1f, 100.0f),
+                  MatLookAt((f3){ 1.0f, 2.0f, -3.0f }, (f3){ 0.0f, 0.0f, 0.0f }, (f3){ 0.0f, 1.0f, 0.0f }));
+  f4x4 b[MATRICES], out[MATRICES];
+  for (int i = 0; i < MATRICES; i++) b[i] = test_transform(i);
+
+  MatMulArray(&a, b, out, MATRICES);
+  for (int i = 0; i < MATRICES; i++)
+  {
+    f4x4 want = MatMul(a, b[i]);
+    expect_matrix("MatMulArray", i, &out[i], &want);
+  }
+
+  // In place, out aliasing b
+  MatMulArray(&a, b, b, MATRICES);
+  for (int i = 0; i < MATRICES; i++) expect_matrix("MatMulArray in place", i, &b[i], &out[i]);
+}
+
+// MatInverseRT undoes rigid transforms, batch-multiplied back they give the identity
+static void test_inverse_rt()
+{
+  f4x4 identity = MatIdentity();
+  for (int i = 0; i < MATRICES; i++)
+  {
+    f4x4 m = test_transform(i);
+    f4x4 inverse = MatInverseRT(&m);
+    f4x4 product;
+    MatMulArray(&inverse, &m, &product, 1);
+    expect_matrix("MatInverseRT * m", i, &product, &identity);
+  }
+}
+
+// Each MatMulChain step against a plain MatMul fold
+static void test_mat_mul_chain()
+{
+  f4x4 mats[MATRICES];
+  mats[0] = MatPerspective(1.5f, 4.0f / 3.0f, 0.1f, 100.0f);
+  for (int i = 1; i < MATRICES; i++) mats[i] = test_transform(i);
+
+  f4x4 identity = MatIdentity();
+  f4x4 empty = MatMulChain(mats, 0);
+  expect_matrix("MatMulChain empty", 0, &empty, &identity);
+
+  f4x4 want = mats[0];
+  for (int count = 1; count <= MATRICES; count++)
+  {
+    if (count > 1) want = MatMul(want, mats[count - 1]);
+    f4x4 got = MatMulChain(mats, count);
+    expect_matrix("MatMulChain", count, &got, &want);
+  }
+}
+
+// Non-uniform scale and shear, which MatInverseRT cannot undo
+static f4x4 test_affine(int i)
+{
+  f4x4 shear = MatIdentity();
+  shear.f[0][1] = 0.5f + 0.1f * i;
+  shear.f[1][2] = -0.3f;
+  shear.f[2][0] = 0.2f * i;
+  f4x4 scaled = MatTransform((f3){ 1.0f - i, 0.5f * i, 3.0f },
+                             (f3){ 30.0f * i, -20.0f, 5.0f * i },
+                             (f3){ 0.5f + i, 2.0f, 0.25f + 0.5f * i });
+  return i % 2 ? MatMul(scaled, shear) : scaled;
+}
+
+static void test_inverse_affine()
+{
+  f4x4 identity = MatIdentity();
+  f4x4A m[MATRICES], inverse[MATRICES]; // aligned types share the f4x4 layout
+  for (int i = 0; i < MATRICES; i++)
+  {
+    f4x4 affine = test_affine(i);
+    memcpy(&m[i], &affine, sizeof(f4x4));
+  }
+
+  MatInverseAffineArray((const f4x4*)m, (f4x4*)inverse, MATRICES);
+  for (int i = 0; i < MATRICES; i++)
+  {
+    f4x4 single = MatInverseAffine((const f4x4*)&m[i]);
+    expect_matrix("MatInverseAffineArray", i, (const f4x4*)&inverse[i], &single);
+
+    f4x4 product;
+    MatMulArray((const f4x4*)&inverse[i], (const f4x4*)&m[i], &product, 1);
+    expect_matrix("MatInverseAffine * m", i, &product, &identity);
+    product = MatMul(*(const f4x4*)&m[i], single);
+    expect_matrix("m * MatInverseAffine", i, &product, &identity);
+  }
+}
+
+static void test_transform_points()
+{
+  f4x4 m = MatMul(MatPerspective(1.2f, 1.0f, 0.1f, 50.0f), test_transform(3));
+  float x[POINTS], y[POINTS], z[POINTS];
+  float ox[POINTS], oy[POINTS], oz[POINTS], ow[POINTS];
+  for (int i = 0; i < POINTS; i++)
+  {
+    x[i] = 0.3f * i - 2.0f;
+    y[i] = 1.0f - 0.17f * i;
+    z[i] = 0.05f * i * i;
+  }
+
+  MatTransformPoints(&m, (f3SoA){ x, y, z }, (f4SoA){ ox, oy, oz, ow }, POINTS);
+  for (int i = 0; i < POINTS; i++)
+  {
+    float p[4] = { x[i], y[i], z[i], 1.0f }, want[4] = { 0 };
+    for (int r = 0; r < 4; r++)
+      for (int c = 0; c < 4; c++) want[r] += m.f[r][c] * p[c];
+    expect_near("MatTransformPoints.x", i, ox[i], want[0]);
+    expect_near("MatTransformPoints.y", i, oy[i], want[1]);
+    expect_near("MatTransformPoints.z", i, oz[i], want[2]);
+    expect_near("MatTransformPoints.w", i, ow[i], want[3]);
+  }
+
+  // Without w, only x/y/z are written
+  float sx[POINTS], sy[POINTS], sz[POINTS];
+  MatTransformPoints(&m, (f3SoA){ x, y, z }, (f4SoA){ sx, sy, sz, NULL }, POINTS);
+  for (int i = 0; i < POINTS; i++)
+  {
+    expect_near("MatTransformPoints no w.x", i, sx[i], ox[i]);
+    expect_near("MatTransformPoints no w.y", i, sy[i], oy[i]);
+    expect_near("MatTransformPoints no w.z", i, sz[i], oz[i]);
+  }
+}
+
+int main()
+{
+#if defined(GABMATH_AVX)
+  printf("gab_math path: AVX\n");
+#elif defined(GABMATH_SSE)
+  printf("gab_math path: SSE2\n");
+#else
+  printf("gab_math path: scalar\n");
+#endif
+
+  test_mat_mul_array();
+  test_mat_mul_chain();
+  test_inverse_rt();
+  test_inverse_affine();
+  test_transform_points();
+
+  if (s_failures) printf("%d mismatches\n", s_failures);
+  else printf("gab_math batch functions match the scalar ones\n");
+  return s_failures ? 1 : 0;
+}